@@ -0,0 +1,198 @@
+﻿#include "Color_Correction.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// D65 white point and the sRGB primaries, as used by OpenCV's Lab conversions.
+constexpr float WhiteX = 0.950456f;
+constexpr float WhiteZ = 1.088754f;
+constexpr float RgbToXyz[3][3] = {
+    {0.412453f, 0.357580f, 0.180423f},
+    {0.212671f, 0.715160f, 0.072169f},
+    {0.019334f, 0.119193f, 0.950227f},
+};
+constexpr float XyzToRgb[3][3] = {
+    {3.240479f, -1.53715f, -0.498535f},
+    {-0.969256f, 1.875991f, 0.041556f},
+    {0.055648f, -0.204043f, 1.057311f},
+};
+constexpr int Levels = 1 << 16; // Steps of the tables indexed by a linear value in [0, 1]
+constexpr int HistSize = 256;
+
+inline int quantize(float value) {
+    return std::clamp(static_cast<int>(value * (Levels - 1) + 0.5f), 0, Levels - 1);
+}
+
+inline float labF(double t) {
+    return static_cast<float>(t > 0.008856 ? std::cbrt(t) : 7.787 * t + 16.0 / 116.0);
+}
+
+inline float labFInverse(float f) {
+    return f > 6.0f / 29.0f ? f * f * f : (f - 16.0f / 116.0f) / 7.787f;
+}
+
+// Everything per pixel is table lookups and a few multiply-adds; the transcendental functions
+// only run here, once per process.
+struct LabTables {
+    // X/Xn, Y and Z/Zn contributions of each 8-bit level of B, G and R (in that order).
+    float x[3][256];
+    float y[3][256];
+    float z[3][256];
+    std::vector<uchar> lightness; // 8-bit L (L * 255 / 100) of a quantized Y
+    std::vector<float> f;         // Lab f(t) of a quantized X/Xn, Y or Z/Zn
+    std::vector<uchar> encode;    // 8-bit sRGB level of a quantized linear value
+
+    LabTables() : lightness(Levels), f(Levels), encode(Levels) {
+        for (int level = 0; level < 256; ++level) {
+            double v = level / 255.0;
+            float linear = static_cast<float>(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+            for (int channel = 0; channel < 3; ++channel) {
+                int rgb = 2 - channel;
+                x[channel][level] = RgbToXyz[0][rgb] * linear / WhiteX;
+                y[channel][level] = RgbToXyz[1][rgb] * linear;
+                z[channel][level] = RgbToXyz[2][rgb] * linear / WhiteZ;
+            }
+        }
+        for (int i = 0; i < Levels; ++i) {
+            double t = (double)i / (Levels - 1);
+            f[i] = labF(t);
+            double L = 116.0 * f[i] - 16.0;
+            lightness[i] = cv::saturate_cast<uchar>(L * 255.0 / 100.0);
+            double encoded = t <= 0.0031308 ? 12.92 * t : 1.055 * std::pow(t, 1.0 / 2.4) - 0.055;
+            encode[i] = cv::saturate_cast<uchar>(encoded * 255.0);
+        }
+    }
+
+    float yOf(const uchar* bgr) const { return y[0][bgr[0]] + y[1][bgr[1]] + y[2][bgr[2]]; }
+    uchar lightnessOf(const uchar* bgr) const { return lightness[quantize(yOf(bgr))]; }
+};
+
+const LabTables& labTables() {
+    static const LabTables tables;
+    return tables;
+}
+
+// Moves one pixel to lightness `target` (8-bit L): a* and b* are differences of f values, so
+// shifting all three f by the same amount changes L alone.
+inline void setLightness(uchar* bgr, int target, const LabTables& tables) {
+    float fx = tables.f[quantize(tables.x[0][bgr[0]] + tables.x[1][bgr[1]] + tables.x[2][bgr[2]])];
+    float fy = tables.f[quantize(tables.yOf(bgr))];
+    float fz = tables.f[quantize(tables.z[0][bgr[0]] + tables.z[1][bgr[1]] + tables.z[2][bgr[2]])];
+    float delta = (target * (100.0f / 255.0f) + 16.0f) / 116.0f - fy;
+    float X = labFInverse(fx + delta) * WhiteX;
+    float Y = labFInverse(fy + delta);
+    float Z = labFInverse(fz + delta) * WhiteZ;
+    for (int channel = 0; channel < 3; ++channel) {
+        const float* row = XyzToRgb[2 - channel];
+        bgr[channel] = tables.encode[quantize(row[0] * X + row[1] * Y + row[2] * Z)];
+    }
+}
+
+} // namespace
+
+void equalizeLightness(cv::Mat& image, const ClaheParameters& params) {
+    CV_Assert(image.type() == CV_8UC3);
+    if (image.empty()) {
+        return;
+    }
+    const LabTables& tables = labTables();
+    const int tilesX = std::max(params.tileGrid.width, 1);
+    const int tilesY = std::max(params.tileGrid.height, 1);
+
+    // cv::CLAHE pads the image with BORDER_REFLECT_101 up to whole tiles whenever either side is
+    // not a multiple of the grid, and then pads both sides; the padding is reproduced by reading
+    // reflected pixels instead of copying the image.
+    const bool padded = image.cols % tilesX != 0 || image.rows % tilesY != 0;
+    const cv::Size tile(image.cols / tilesX + (padded ? 1 : 0), image.rows / tilesY + (padded ? 1 : 0));
+    const int tileArea = tile.area();
+    int clip = 0;
+    if (params.clipLimit > 0.0) {
+        clip = std::max(static_cast<int>(params.clipLimit * tileArea / HistSize), 1);
+    }
+
+    // Pass 1: lightness histogram of every tile, clipped and turned into its LUT.
+    cv::Mat luts(tilesX * tilesY, HistSize, CV_8UC1);
+    cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range) {
+        std::vector<int> columns(tile.width);
+        for (int index = range.start; index < range.end; ++index) {
+            const int tx = index % tilesX;
+            const int ty = index / tilesX;
+            for (int i = 0; i < tile.width; ++i) {
+                columns[i] = cv::borderInterpolate(tx * tile.width + i, image.cols, cv::BORDER_REFLECT_101);
+            }
+            int hist[HistSize] = {};
+            for (int j = 0; j < tile.height; ++j) {
+                const uchar* row = image.ptr<uchar>(cv::borderInterpolate(ty * tile.height + j, image.rows, cv::BORDER_REFLECT_101));
+                for (int column : columns) {
+                    ++hist[tables.lightnessOf(row + 3 * column)];
+                }
+            }
+
+            if (clip > 0) {
+                int clipped = 0;
+                for (int& count : hist) {
+                    if (count > clip) {
+                        clipped += count - clip;
+                        count = clip;
+                    }
+                }
+                const int batch = clipped / HistSize;
+                int residual = clipped - batch * HistSize;
+                for (int& count : hist) {
+                    count += batch;
+                }
+                if (residual != 0) {
+                    const int step = std::max(HistSize / residual, 1);
+                    for (int i = 0; i < HistSize && residual > 0; i += step, --residual) {
+                        ++hist[i];
+                    }
+                }
+            }
+
+            const float scale = 255.0f / tileArea;
+            uchar* lut = luts.ptr<uchar>(index);
+            int sum = 0;
+            for (int i = 0; i < HistSize; ++i) {
+                sum += hist[i];
+                lut[i] = cv::saturate_cast<uchar>(sum * scale);
+            }
+        }
+    });
+
+    // Pass 2: bilinear interpolation between the four nearest tile LUTs, as cv::CLAHE does it,
+    // and the new lightness written straight back into BGR.
+    std::vector<int> left(image.cols), right(image.cols);
+    std::vector<float> weight(image.cols);
+    const float inverseWidth = 1.0f / tile.width;
+    for (int x = 0; x < image.cols; ++x) {
+        float txf = x * inverseWidth - 0.5f;
+        int tx = cvFloor(txf);
+        weight[x] = txf - tx;
+        left[x] = std::max(tx, 0) * HistSize;
+        right[x] = std::min(tx + 1, tilesX - 1) * HistSize;
+    }
+    const float inverseHeight = 1.0f / tile.height;
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            float tyf = y * inverseHeight - 0.5f;
+            int ty = cvFloor(tyf);
+            const float ya = tyf - ty;
+            const uchar* upper = luts.ptr<uchar>(std::max(ty, 0) * tilesX);
+            const uchar* lower = luts.ptr<uchar>(std::min(ty + 1, tilesY - 1) * tilesX);
+            uchar* row = image.ptr<uchar>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                uchar* bgr = row + 3 * x;
+                const int current = tables.lightnessOf(bgr);
+                const float xa = weight[x];
+                float value = (upper[left[x] + current] * (1.0f - xa) + upper[right[x] + current] * xa) * (1.0f - ya)
+                            + (lower[left[x] + current] * (1.0f - xa) + lower[right[x] + current] * xa) * ya;
+                const int target = cv::saturate_cast<uchar>(value);
+                if (target != current) {
+                    setLightness(bgr, target, tables);
+                }
+            }
+        }
+    });
+}
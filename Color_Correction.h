@@ -0,0 +1,20 @@
+﻿// Color_Correction.h : CLAHE on Lab lightness, fused so no full-size Lab image is ever built.
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Parameters of cv::createCLAHE.
+struct ClaheParameters {
+    double clipLimit = 2.0;              // Histogram clip level relative to a flat histogram; 0 disables clipping
+    cv::Size tileGrid = cv::Size(8, 8);  // Tiles across and down that get their own histogram
+};
+
+// Equalizes the Lab lightness of a BGR image in place with CLAHE, keeping a* and b*. This is
+// BGR2Lab, CLAHE on L and Lab2BGR in two passes over the image and without any full-size
+// temporary: the first pass computes L from lookup tables and fills the tile histograms, the
+// second recomputes L, interpolates the tile LUTs exactly like cv::CLAHE and moves the pixel
+// along L only. Colours are carried in float instead of being rounded to 8-bit Lab in between,
+// so results match the OpenCV round trip to within a level or two per channel, and pixels whose
+// L8 does not change are left untouched. Both passes run on OpenCV's worker threads.
+void equalizeLightness(cv::Mat& image, const ClaheParameters& params);
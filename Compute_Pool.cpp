@@ -0,0 +1,63 @@
+﻿#include "Compute_Pool.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+ComputePool::ComputePool(std::size_t threadCount, std::size_t maxQueued)
+    : maxQueued_(std::max<std::size_t>(1, maxQueued)) {
+    threadCount = std::max<std::size_t>(1, threadCount);
+    workers_.reserve(threadCount);
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        workers_.emplace_back([this] { workerLoop(); });
+    }
+    std::cout << "[Compute] Started " << threadCount << " worker threads, queue depth " << maxQueued_ << std::endl;
+}
+
+ComputePool::~ComputePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeUp_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+bool ComputePool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || tasks_.size() >= maxQueued_) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+    }
+    wakeUp_.notify_one();
+    return true;
+}
+
+std::size_t ComputePool::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void ComputePool::workerLoop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeUp_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        try {
+            task();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "[Compute] Task threw: " << e.what() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+﻿// Compute_Pool.h : Worker threads for image processing, kept apart from Crow's IO threads.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads with a bounded FIFO queue. Route handlers hand the
+// heavy work to the pool and return to the event loop straight away, so a long
+// denoise never stalls the other connections served by the same io_context.
+class ComputePool {
+public:
+    ComputePool(std::size_t threadCount, std::size_t maxQueued);
+    // Runs whatever is still queued, then joins the workers.
+    ~ComputePool();
+
+    ComputePool(const ComputePool&) = delete;
+    ComputePool& operator=(const ComputePool&) = delete;
+
+    // Queues a task. Returns false without queuing when the queue is already full.
+    bool submit(std::function<void()> task);
+
+    std::size_t threadCount() const { return workers_.size(); }
+    std::size_t maxQueued() const { return maxQueued_; }
+    std::size_t queued() const;
+
+private:
+    void workerLoop();
+
+    std::size_t maxQueued_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
@@ -232,6 +232,12 @@ namespace crow
             return router_.handle_initial(req, res);
         }
 
+        /// \brief The rule a request was routed to, used to apply its body size limit and body stream
+        BaseRule* matched_rule(const routing_handle_result& found)
+        {
+            return router_.matched_rule(found);
+        }
+
         /// \brief Process the fully parsed request and generate a response for it
         void handle(request& req, response& res, std::unique_ptr<routing_handle_result>& found)
         {
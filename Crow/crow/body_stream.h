@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace crow
+{
+    struct request;
+
+    /// Receives a request body piece by piece as it is read from the socket.
+
+    ///
+    /// A rule with a body stream factory (see `RuleParameterTraits::stream_body`) gets one of these
+    /// per request, and the body is handed to it instead of being collected in `request::body`.
+    /// The handler finds it again in `request::streamed_body` once the whole body has arrived.
+    struct body_stream
+    {
+        virtual ~body_stream() = default;
+
+        /// Called with each piece of the body, in order. Return false to reject the request with `error_status()`.
+        virtual bool write(const char* data, size_t size) = 0;
+
+        /// Called once after the last piece, before the handler runs. Return false to reject the request with `error_status()`.
+        virtual bool finish() { return true; }
+
+        /// The status sent to the client when `write` or `finish` fails.
+        virtual int error_status() const { return 400; }
+    };
+
+    /// Creates the body stream for a request once its headers are parsed. Returning nullptr buffers the body in `request::body` as usual.
+    using body_stream_factory = std::function<std::shared_ptr<body_stream>(const request&)>;
+} // namespace crow
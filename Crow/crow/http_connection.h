@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -119,8 +121,33 @@ namespace crow
             }
         }
 
-        void handle_header()
+        /// Applies the matched rule's body limit and body stream. Returns false if the request was rejected.
+        bool handle_header()
         {
+            body_bytes_ = 0;
+            max_body_size_ = 0;
+            BaseRule* rule = routing_handle_result_ ? handler_->matched_rule(*routing_handle_result_) : nullptr;
+            if (rule)
+            {
+                max_body_size_ = rule->get_max_body_size();
+                bool has_content_length = parser_.content_length != CROW_ULLONG_MAX && !(parser_.flags & F_CHUNKED);
+                // Refuse before the client sends the body (and before 100 Continue).
+                if (has_content_length && max_body_size_ && parser_.content_length > max_body_size_)
+                {
+                    reject_request(status::PAYLOAD_TOO_LARGE);
+                    return false;
+                }
+                if (rule->get_body_stream_factory())
+                {
+                    req_.streamed_body = rule->get_body_stream_factory()(req_);
+                }
+                // A declared length is only trusted for a single allocation when it was checked against a limit.
+                if (!req_.streamed_body && has_content_length && max_body_size_)
+                {
+                    req_.body.reserve(static_cast<size_t>(parser_.content_length));
+                }
+            }
+
             // HTTP 1.1 Expect: 100-continue
             if (req_.http_ver_major == 1 && req_.http_ver_minor == 1 && get_header_value(req_.headers, "expect") == "100-continue")
             {
@@ -130,10 +157,39 @@ namespace crow
                 buffers_.emplace_back(expect_100_continue.data(), expect_100_continue.size());
                 do_write_sync(buffers_);
             }
+            return true;
+        }
+
+        /// Passes a piece of the body to the request's body stream, or appends it to `request::body`. Returns false if the request was rejected.
+        bool handle_body(const char* data, size_t length)
+        {
+            body_bytes_ += length;
+            // Chunked bodies have no declared length, so the limit is also checked as they arrive.
+            if (max_body_size_ && body_bytes_ > max_body_size_)
+            {
+                reject_request(status::PAYLOAD_TOO_LARGE);
+                return false;
+            }
+            if (req_.streamed_body)
+            {
+                if (!req_.streamed_body->write(data, length))
+                {
+                    reject_request(req_.streamed_body->error_status());
+                    return false;
+                }
+                return true;
+            }
+            req_.body.append(data, length);
+            return true;
         }
 
         void handle()
         {
+            if (req_.streamed_body && !req_.streamed_body->finish())
+            {
+                reject_request(req_.streamed_body->error_status());
+                return;
+            }
             // TODO(EDev): cancel_deadline_timer should be looked into, it might be a good idea to add it to handle_url() and then restart the timer once everything passes
             cancel_deadline_timer();
             bool is_invalid_request = false;
@@ -197,6 +253,12 @@ namespace crow
                     res.complete_request_handler_ = [self] {
                         self->complete_request();
                     };
+                    res.begin_chunked_handler_ = [self] {
+                        self->begin_chunked_response();
+                    };
+                    res.write_chunk_handler_ = [self](std::shared_ptr<const void> owner, const char* data, size_t size) {
+                        self->write_chunk(std::move(owner), data, size);
+                    };
                     need_to_call_after_handlers_ = true;
                     handler_->handle(req_, res, routing_handle_result_);
                     if (add_keep_alive_)
@@ -259,6 +321,12 @@ namespace crow
             }
 #endif
 
+            if (res.is_chunked())
+            {
+                finish_chunked_response();
+                return;
+            }
+
             prepare_buffers();
 
             if (res.is_static_type())
@@ -272,10 +340,31 @@ namespace crow
         }
 
     private:
-        void prepare_buffers()
+        /// Answers with `code` without running the handler and closes the connection once the
+        /// response is written, since the rest of the body is never read.
+        void reject_request(int code)
+        {
+            CROW_LOG_INFO << "Rejecting request " << req_.url << " with " << code;
+            body_rejected_ = true;
+            req_.streamed_body.reset();
+            res = response(code);
+            add_keep_alive_ = false;
+            close_connection_ = true;
+            need_to_call_after_handlers_ = false;
+            complete_request();
+        }
+
+        void release_response_handlers()
         {
             res.complete_request_handler_ = nullptr;
             res.is_alive_helper_ = nullptr;
+            res.begin_chunked_handler_ = nullptr;
+            res.write_chunk_handler_ = nullptr;
+        }
+
+        void prepare_buffers()
+        {
+            release_response_handlers();
 
             if (!adaptor_.is_open())
             {
@@ -283,6 +372,12 @@ namespace crow
                 //delete this;
                 return;
             }
+            prepare_header_buffers();
+        }
+
+        /// Fills `buffers_` with the status line and headers of `res`.
+        void prepare_header_buffers()
+        {
             // TODO(EDev): HTTP version in status codes should be dynamic
             // Keep in sync with common.h/status
             static std::unordered_map<int, std::string> statusCodes = {
@@ -346,7 +441,7 @@ namespace crow
             auto& status = statusCodes.find(res.code)->second;
             buffers_.emplace_back(status.data(), status.size());
 
-            if (res.code >= 400 && res.body.empty())
+            if (res.code >= 400 && res.body.empty() && !res.has_shared_body())
                 res.body = statusCodes[res.code].substr(9);
 
             for (auto& kv : res.headers)
@@ -359,7 +454,7 @@ namespace crow
 
             if (!res.manual_length_header && !res.headers.count("content-length"))
             {
-                content_length_ = std::to_string(res.body.size());
+                content_length_ = std::to_string(res.body_size());
                 static std::string content_length_tag = "Content-Length: ";
                 buffers_.emplace_back(content_length_tag.data(), content_length_tag.size());
                 buffers_.emplace_back(content_length_.data(), content_length_.size());
@@ -390,6 +485,147 @@ namespace crow
             buffers_.emplace_back(crlf.data(), crlf.size());
         }
 
+        /// Queues the status line and headers of a chunked response (see response::begin_chunked).
+        void begin_chunked_response()
+        {
+            if (!adaptor_.is_open())
+                return;
+            // The body may take much longer than the deadline to produce; from here on the
+            // deadline only runs while a chunk is being written.
+            cancel_deadline_timer();
+            prepare_header_buffers();
+            queue_header_buffers();
+            write_next_queued();
+        }
+
+        /// Queues the status line and headers in `buffers_`. They point into `res`, which changes
+        /// before they are written, so they are copied.
+        void queue_header_buffers()
+        {
+            queued_write head;
+            for (const auto& buffer : buffers_)
+                head.prefix.append(static_cast<const char*>(buffer.data()), buffer.size());
+            buffers_.clear();
+            queued_writes_.push_back(std::move(head));
+        }
+
+        /// Queues one chunk of a chunked response. Without an `owner` the bytes are copied,
+        /// otherwise `owner` keeps them alive until they are written.
+        void write_chunk(std::shared_ptr<const void> owner, const char* data, size_t size)
+        {
+            if (!adaptor_.is_open())
+                return;
+            char size_line[20];
+            int size_line_length = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+            queued_write chunk;
+            chunk.prefix.assign(size_line, static_cast<size_t>(size_line_length));
+            if (owner)
+            {
+                chunk.owner = std::move(owner);
+                chunk.data = data;
+                chunk.size = size;
+                chunk.crlf_after = true;
+            }
+            else
+            {
+                chunk.prefix.append(data, size);
+                chunk.prefix.append(crlf);
+            }
+            queued_writes_.push_back(std::move(chunk));
+            write_next_queued();
+        }
+
+        /// Queues the last chunk once the response is ended; the connection goes on like after any
+        /// other response when it has been written.
+        void finish_chunked_response()
+        {
+            release_response_handlers();
+            res.clear();
+            finish_after_writes_ = true;
+            if (adaptor_.is_open())
+            {
+                queued_write last_chunk;
+                last_chunk.prefix = "0\r\n\r\n";
+                queued_writes_.push_back(std::move(last_chunk));
+            }
+            write_next_queued();
+        }
+
+        /// Starts writing the oldest queued piece of a chunked or shared-body response unless one is
+        /// being written. Writes never block the IO thread. The deadline is re-armed whenever bytes
+        /// go out, so a slow client is served while a stalled one is closed; a failed write closes
+        /// the connection, so the producer sees it through response::is_alive() and stops.
+        void write_next_queued()
+        {
+            if (queued_writing_)
+                return;
+            if (queued_writes_.empty() || !adaptor_.is_open())
+            {
+                queued_writes_.clear();
+                if (finish_after_writes_)
+                    end_queued_response();
+                return;
+            }
+
+            const queued_write& next = queued_writes_.front();
+            queued_buffers_.clear();
+            queued_buffers_.emplace_back(next.prefix.data(), next.prefix.size());
+            if (next.size > 0)
+                queued_buffers_.emplace_back(next.data, next.size);
+            if (next.crlf_after)
+                queued_buffers_.emplace_back(crlf.data(), crlf.size());
+
+            queued_writing_ = true;
+            auto self = this->shared_from_this();
+            asio::async_write(
+              adaptor_.socket(), queued_buffers_,
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) -> std::size_t {
+                  if (ec)
+                      return 0;
+                  self->start_deadline();
+                  return 65536;
+              },
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  self->cancel_deadline_timer();
+                  self->queued_writing_ = false;
+                  self->queued_writes_.pop_front();
+                  if (ec)
+                  {
+                      CROW_LOG_DEBUG << self << " from write (queued) with error: " << ec.message();
+                      self->adaptor_.shutdown_readwrite();
+                      self->adaptor_.close();
+                  }
+                  self->write_next_queued();
+              });
+        }
+
+        /// Called once the last queued piece of a response is written, or dropped with a closed
+        /// connection. Only from here does the connection read its next request.
+        void end_queued_response()
+        {
+            finish_after_writes_ = false;
+            if (close_connection_ && adaptor_.is_open())
+            {
+                adaptor_.shutdown_readwrite();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write (queued)";
+            }
+
+            if (need_to_start_read_after_complete_)
+            {
+                need_to_start_read_after_complete_ = false;
+                // The handler is done with the request and its response, so the next request starts
+                // from a clear parser and response (handle() may have set headers after completion).
+                if (adaptor_.is_open())
+                {
+                    parser_.clear();
+                    res.clear();
+                }
+                start_deadline();
+                do_read();
+            }
+        }
+
         void do_write_static()
         {
             asio::write(adaptor_.socket(), buffers_);
@@ -422,7 +658,23 @@ namespace crow
 
         void do_write_general()
         {
-            if (res.body.length() < res_stream_threshold_)
+            if (res.has_shared_body())
+            {
+                // Multi-megabyte bodies are written asynchronously straight from the shared buffer,
+                // like the chunks of a chunked response, so a slow client does not hold up the IO
+                // thread and a stalled one is closed by the write deadline.
+                cancel_deadline_timer();
+                queue_header_buffers();
+                queued_write body;
+                body.owner = std::move(res.shared_body_owner_);
+                body.data = res.shared_body_data_;
+                body.size = res.shared_body_size_;
+                queued_writes_.push_back(std::move(body));
+                res.clear_shared_body();
+                finish_after_writes_ = true;
+                write_next_queued();
+            }
+            else if (res.body.length() < res_stream_threshold_)
             {
                 res_body_copy_.swap(res.body);
                 buffers_.emplace_back(res_body_copy_.data(), res_body_copy_.size());
@@ -483,7 +735,13 @@ namespace crow
                       }
                   }
 
-                  if (error_while_reading)
+                  if (error_while_reading && self->body_rejected_ && self->adaptor_.is_open())
+                  {
+                      // The parser stopped on purpose; the rejection is being written and closes the connection.
+                      self->cancel_deadline_timer();
+                      self->body_rejected_ = false;
+                  }
+                  else if (error_while_reading)
                   {
                       self->cancel_deadline_timer();
                       self->parser_.done();
@@ -497,14 +755,16 @@ namespace crow
                       self->parser_.done();
                       // adaptor will close after write
                   }
-                  else if (!self->need_to_call_after_handlers_)
+                  else if (!self->need_to_call_after_handlers_ && !self->finish_after_writes_)
                   {
                       self->start_deadline();
                       self->do_read();
                   }
                   else
                   {
-                      // res will be completed later by user
+                      // res will be completed later by user, or it was completed in the handler
+                      // and its queued writes are still going out; end_queued_response reads on
+                      // once the last one is written, so a next request cannot interleave
                       self->need_to_start_read_after_complete_ = true;
                   }
               });
@@ -594,6 +854,9 @@ namespace crow
         response res;
 
         bool close_connection_ = false;
+        bool body_rejected_ = false;
+        uint64_t body_bytes_ = 0;
+        uint64_t max_body_size_ = 0;
 
         const std::string& server_name_;
         std::vector<asio::const_buffer> buffers_;
@@ -602,6 +865,21 @@ namespace crow
         std::string date_str_;
         std::string res_body_copy_;
 
+        /// A piece of a response waiting to be written: `prefix`, then `size` bytes at
+        /// `data` kept alive by `owner`, then a CRLF if `crlf_after`.
+        struct queued_write
+        {
+            std::string prefix;
+            std::shared_ptr<const void> owner;
+            const char* data = nullptr;
+            size_t size = 0;
+            bool crlf_after = false;
+        };
+        std::deque<queued_write> queued_writes_;
+        std::vector<asio::const_buffer> queued_buffers_;
+        bool queued_writing_ = false;
+        bool finish_after_writes_ = false;
+
         detail::task_timer::identifier_type task_id_{};
 
         bool continue_requested{};
@@ -9,6 +9,7 @@
 #include <asio.hpp>
 #endif
 
+#include "crow/body_stream.h"
 #include "crow/common.h"
 #include "crow/ci_map.h"
 #include "crow/query_string.h"
@@ -40,6 +41,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         query_string url_params; ///< The parameters associated with the request. (everything after the `?` in the URL)
         ci_map headers;
         std::string body;
+        std::shared_ptr<body_stream> streamed_body; ///< Receives the body instead of `body` when the matched rule streams it.
         std::string remote_ip_address; ///< The IP address from which the request was sent.
         unsigned char http_ver_major, http_ver_minor;
         bool keep_alive,    ///< Whether or not the server should send a `connection: Keep-Alive` header to the client.
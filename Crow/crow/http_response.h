@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <ios>
@@ -170,6 +171,10 @@ namespace crow
             headers = std::move(r.headers);
             completed_ = r.completed_;
             file_info = std::move(r.file_info);
+            shared_body_owner_ = std::move(r.shared_body_owner_);
+            shared_body_data_ = r.shared_body_data_;
+            shared_body_size_ = r.shared_body_size_;
+            chunked_ = r.chunked_;
             return *this;
         }
 
@@ -186,6 +191,8 @@ namespace crow
             headers.clear();
             completed_ = false;
             file_info = static_file_info{};
+            clear_shared_body();
+            chunked_ = false;
         }
 
         /// Return a "Temporary Redirect" response.
@@ -241,13 +248,18 @@ namespace crow
                 completed_ = true;
                 if (skip_body)
                 {
-                    set_header("Content-Length", std::to_string(body.size()));
+                    set_header("Content-Length", std::to_string(body_size()));
                     body = "";
+                    clear_shared_body();
                     manual_length_header = true;
                 }
                 if (complete_request_handler_)
                 {
-                    complete_request_handler_();
+                    // For a response completed after its handler returned, the handler holds the
+                    // last reference to the connection that owns this response, and the connection
+                    // resets it while it runs; call a copy so both outlive the call.
+                    auto complete_request_handler = complete_request_handler_;
+                    complete_request_handler();
                     manual_length_header = false;
                     skip_body = false;
                 }
@@ -261,12 +273,78 @@ namespace crow
             end();
         }
 
+        /// Send the status line and headers now and the body in pieces, with `Transfer-Encoding: chunked`.
+
+        ///
+        /// For responses completed after the handler returns: like end(), call it on the
+        /// connection's IO thread once the code and headers are set. Each `write_chunk` is then
+        /// queued and written asynchronously in order, and end() sends the last chunk. Does nothing if the response is
+        /// already completed or the connection does not support it.
+        void begin_chunked()
+        {
+            if (completed_ || chunked_ || !begin_chunked_handler_)
+                return;
+            chunked_ = true;
+            set_header("Transfer-Encoding", "chunked");
+            manual_length_header = true;
+            auto begin_chunked_handler = begin_chunked_handler_;
+            begin_chunked_handler();
+        }
+
+        /// Send `size` bytes at `data` as one chunk of a body started with `begin_chunked`.
+
+        ///
+        /// The bytes are copied, so they only need to live for the call.
+        void write_chunk(const char* data, size_t size)
+        {
+            write_chunk(nullptr, data, size);
+        }
+
+        /// Like write_chunk(data, size), but without a copy: `owner` keeps the bytes alive until
+        /// they are written.
+        void write_chunk(std::shared_ptr<const void> owner, const char* data, size_t size)
+        {
+            if (chunked_ && !completed_ && size > 0 && write_chunk_handler_)
+                write_chunk_handler_(std::move(owner), data, size);
+        }
+
+        /// Check whether the body is being sent with `begin_chunked`.
+        bool is_chunked() const
+        {
+            return chunked_;
+        }
+
         /// Check if the connection is still alive (usually by checking the socket status).
         bool is_alive()
         {
             return is_alive_helper_ && is_alive_helper_();
         }
 
+        /// Send `size` bytes at `data` as the body without copying them into `body`.
+
+        ///
+        /// `owner` keeps the bytes alive until the response is written, so a buffer shared with a
+        /// cache or store is written to the socket as it is.
+        void set_shared_body(std::shared_ptr<const void> owner, const char* data, size_t size)
+        {
+            body.clear();
+            shared_body_owner_ = std::move(owner);
+            shared_body_data_ = data;
+            shared_body_size_ = size;
+        }
+
+        /// Check whether the body was set with `set_shared_body`.
+        bool has_shared_body() const
+        {
+            return shared_body_owner_ != nullptr;
+        }
+
+        /// Size of the body, whether it is held in `body` or shared.
+        size_t body_size() const
+        {
+            return has_shared_body() ? shared_body_size_ : body.size();
+        }
+
         /// Check whether the response has a static file defined.
         bool is_static_type()
         {
@@ -319,9 +397,22 @@ namespace crow
         }
 
     private:
+        void clear_shared_body()
+        {
+            shared_body_owner_.reset();
+            shared_body_data_ = nullptr;
+            shared_body_size_ = 0;
+        }
+
         bool completed_{};
         std::function<void()> complete_request_handler_;
         std::function<bool()> is_alive_helper_;
+        std::function<void()> begin_chunked_handler_;
+        std::function<void(std::shared_ptr<const void>, const char*, size_t)> write_chunk_handler_;
         static_file_info file_info;
+        std::shared_ptr<const void> shared_body_owner_;
+        const char* shared_body_data_ = nullptr;
+        size_t shared_body_size_ = 0;
+        bool chunked_ = false;
     };
 } // namespace crow
@@ -82,14 +82,13 @@ namespace crow
 
             self->set_connection_parameters();
 
-            self->process_header();
-            return 0;
+            // Any value other than 0, 1 or 2 makes the parser stop with an error.
+            return self->process_header() ? 0 : -1;
         }
         static int on_body(http_parser* self_, const char* at, size_t length)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
-            self->req.body.insert(self->req.body.end(), at, at + length);
-            return 0;
+            return self->process_body(at, length) ? 0 : -1;
         }
         static int on_message_complete(http_parser* self_)
         {
@@ -153,9 +152,14 @@ namespace crow
             handler_->handle_url();
         }
 
-        inline void process_header()
+        inline bool process_header()
+        {
+            return handler_->handle_header();
+        }
+
+        inline bool process_body(const char* at, size_t length)
         {
-            handler_->handle_header();
+            return handler_->handle_body(at, length);
         }
 
         inline void process_message()
@@ -148,6 +148,11 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
         const std::string& rule() { return rule_; }
 
+        /// Largest accepted request body in bytes, 0 for no limit.
+        uint64_t get_max_body_size() const { return max_body_size_; }
+
+        const body_stream_factory& get_body_stream_factory() const { return body_stream_factory_; }
+
     protected:
         uint32_t methods_{1 << static_cast<int>(HTTPMethod::Get)};
 
@@ -159,6 +164,9 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
         detail::middleware_indices mw_indices_;
 
+        uint64_t max_body_size_{0};
+        body_stream_factory body_stream_factory_;
+
         friend class Router;
         friend class Blueprint;
         template<typename T>
@@ -561,6 +569,20 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             static_cast<self_t*>(this)->mw_indices_.template push<App, Middlewares...>();
             return static_cast<self_t&>(*this);
         }
+
+        /// Reject request bodies larger than `size` bytes with 413, before reading them when `Content-Length` is sent.
+        self_t& max_body_size(uint64_t size)
+        {
+            static_cast<self_t*>(this)->max_body_size_ = size;
+            return static_cast<self_t&>(*this);
+        }
+
+        /// Hand the request body to a stream created by `factory` as it arrives, instead of collecting it in `request::body`.
+        self_t& stream_body(body_stream_factory factory)
+        {
+            static_cast<self_t*>(this)->body_stream_factory_ = std::move(factory);
+            return static_cast<self_t&>(*this);
+        }
     };
 
     /// A rule that can change its parameters during runtime.
@@ -1673,6 +1695,15 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             }
         }
 
+        /// The rule a request was routed to by `handle_initial`, or nullptr if there is none.
+        BaseRule* matched_rule(const routing_handle_result& found)
+        {
+            if (!found.rule_index || found.rule_index == RULE_SPECIAL_REDIRECT_SLASH || found.method >= HTTPMethod::InternalMethodCount)
+                return nullptr;
+            auto& rules = per_methods_[static_cast<int>(found.method)].rules;
+            return found.rule_index < rules.size() ? rules[found.rule_index] : nullptr;
+        }
+
         template<typename App>
         void handle(request& req, response& res, routing_handle_result found)
         {
@@ -0,0 +1,320 @@
+﻿#include "Photo_Enhancer.h"
+#include "Color_Correction.h"
+#include "Face_Beautify.h"
+#include "Face_Detection.h"
+#include "Guided_Filter.h"
+#include "Latency_Model.h"
+#include "Pipeline_Planner.h"
+#include "Super_Resolution.h"
+#include "Tiled_Denoise.h"
+#include "Tiled_Execution.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+
+cv::Mat decodeImage(const char* data, std::size_t size) {
+    if (data == nullptr || size == 0) {
+        return cv::Mat();
+    }
+    // Wrap the buffer without copying; imdecode only reads from it.
+    cv::Mat encoded(1, static_cast<int>(size), CV_8UC1, const_cast<char*>(data));
+    return cv::imdecode(encoded, cv::IMREAD_COLOR);
+}
+
+cv::Mat decodeImageFile(const std::string& path) {
+    return cv::imread(path, cv::IMREAD_COLOR);
+}
+
+void enhanceImage(const std::string& inputPath, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality) {
+    std::cout << "[Enhance] Input: " << inputPath << ", Output: " << outputPath << std::endl;
+    cv::Mat image = cv::imread(inputPath);
+    if (image.empty()) {
+        std::cerr << "[Enhance] Error: Cannot load image!" << std::endl;
+        return;
+    }
+    enhanceImage(image, outputPath, sharpen, denoise, colorCorrection, superResolution, beautify, outputFormat, jpegQuality);
+}
+
+void enhanceImage(const char* data, std::size_t size, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality) {
+    std::cout << "[Enhance] Input: " << size << " bytes in memory, Output: " << outputPath << std::endl;
+    cv::Mat image = decodeImage(data, size);
+    if (image.empty()) {
+        std::cerr << "[Enhance] Error: Cannot decode image!" << std::endl;
+        return;
+    }
+    enhanceImage(image, outputPath, sharpen, denoise, colorCorrection, superResolution, beautify, outputFormat, jpegQuality);
+}
+
+void enhanceImage(const cv::Mat& image, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality) {
+    EnhanceOptions options;
+    options.sharpen = sharpen;
+    options.denoise = denoise;
+    options.colorCorrection = colorCorrection;
+    options.superResolution = superResolution;
+    options.beautify = beautify;
+    options.outputFormat = outputFormat;
+    options.jpegQuality = jpegQuality;
+    cv::Mat enhanced = applyEnhancements(image, options);
+
+    EncodedImage result = encodeImage(enhanced, outputFormat, jpegQuality);
+    if (result.bytes.empty()) {
+        std::cerr << "[Enhance] Error: Failed to save enhanced image!" << std::endl;
+        return;
+    }
+    std::ofstream outFile(outputPath, std::ios::binary);
+    outFile.write(result.bytes.data(), result.bytes.size());
+    if (!outFile) {
+        std::cerr << "[Enhance] Error: Failed to save enhanced image!" << std::endl;
+    } else {
+        std::cout << "[Enhance] Enhanced image saved: " << outputPath << std::endl;
+    }
+}
+
+std::vector<std::string> pipelineStages(const EnhanceOptions& options) {
+    // The stage order does not depend on the image size, only the working resolutions do.
+    return planPipeline(options, cv::Size()).stageOrder();
+}
+
+static void reportProgress(const ProgressCallback& progress, const std::string& stage, double value) {
+    if (progress) {
+        progress(stage, value);
+    }
+}
+
+static void sharpenImage(cv::Mat& enhanced, bool tiled) {
+    std::cout << "[Enhance] Applying adaptive sharpen..." << std::endl;
+    const double sigma = 2.0;
+    float alpha = 0.7f; // Less aggressive sharpening
+    auto sharpen = [&](cv::Mat& image) {
+        cv::Mat blurred;
+        cv::GaussianBlur(image, blurred, cv::Size(0, 0), sigma);
+        cv::addWeighted(image, 1 + alpha, blurred, -alpha, 0, image);
+    };
+    if (tiled) {
+        // The Gaussian kernel reaches at most 4 sigma.
+        filterInStrips(enhanced, cvCeil(4 * sigma), [&](const cv::Mat& input) {
+            cv::Mat strip = input;
+            sharpen(strip);
+            return strip;
+        });
+    } else {
+        sharpen(enhanced);
+    }
+    std::cout << "[Enhance] Sharpen applied." << std::endl;
+}
+
+static void resampleImage(cv::Mat& enhanced, cv::Size targetSize, int interpolation) {
+    if (enhanced.size() == targetSize) {
+        return;
+    }
+    cv::resize(enhanced, enhanced, targetSize, 0, 0, interpolation);
+    std::cout << "[Enhance] Resampled to " << targetSize.width << "x" << targetSize.height << std::endl;
+}
+
+// The "fast" mode: guided filter, linear time whatever the window.
+static void denoiseImageFast(cv::Mat& enhanced, bool tiled, const std::function<void(double)>& onProgress) {
+    std::cout << "[Enhance] Applying fast guided-filter denoise at " << enhanced.cols << "x" << enhanced.rows << "..." << std::endl;
+    GuidedDenoiseParameters params;
+    if (tiled) {
+        filterInStrips(enhanced, params.halo(), [&params](const cv::Mat& input) {
+            return denoiseGuided(input, params);
+        }, onProgress);
+    } else {
+        enhanced = denoiseGuided(enhanced, params, onProgress);
+    }
+    std::cout << "[Enhance] Denoise applied." << std::endl;
+}
+
+static void denoiseImage(cv::Mat& enhanced, const std::string& mode, bool tiled, const std::function<void(double)>& onProgress) {
+    if (mode == "fast") {
+        denoiseImageFast(enhanced, tiled, onProgress);
+        return;
+    }
+    std::cout << "[Enhance] Applying tuned denoise at " << enhanced.cols << "x" << enhanced.rows << "..." << std::endl;
+    // Use faster parameters
+    NlmParameters params;
+    params.h = 2;
+    params.hColor = 2;
+    params.templateWindow = 5;
+    params.searchWindow = 11;
+    if (tiled) {
+        // Strips of tiles: progress is reported per strip, the tiles of a strip still run in parallel.
+        filterInStrips(enhanced, params.halo(), [&params](const cv::Mat& input) {
+            return denoiseTiled(input, params, 256);
+        }, onProgress);
+    } else {
+        enhanced = denoiseTiled(enhanced, params, 256, onProgress);
+    }
+    std::cout << "[Enhance] Denoise applied." << std::endl;
+}
+
+static void correctColor(cv::Mat& enhanced, const EnhanceOptions& options) {
+    std::cout << "[Enhance] Applying CLAHE-based color correction..." << std::endl;
+    // Fused BGR -> L -> CLAHE -> BGR: two passes and no full-size Lab planes, so it needs no
+    // strip mode for large images either.
+    ClaheParameters params;
+    params.clipLimit = options.claheClipLimit;
+    params.tileGrid = options.claheTileGrid;
+    equalizeLightness(enhanced, params);
+    std::cout << "[Enhance] Color correction applied." << std::endl;
+}
+
+static void smoothFaces(cv::Mat& enhanced, const std::vector<cv::Rect>& faces) {
+    beautifyFaces(enhanced, faces);
+    std::cout << "[Enhance] Beautify applied to " << faces.size() << " faces." << std::endl;
+}
+
+// Maps face rects found at one working scale onto another, clipped to the image.
+static std::vector<cv::Rect> rescaleFaces(const std::vector<cv::Rect>& faces, double factor, cv::Size imageSize) {
+    std::vector<cv::Rect> scaled;
+    cv::Rect bounds(0, 0, imageSize.width, imageSize.height);
+    for (const cv::Rect& face : faces) {
+        cv::Rect mapped(cvRound(face.x * factor), cvRound(face.y * factor), cvRound(face.width * factor), cvRound(face.height * factor));
+        mapped = mapped & bounds;
+        if (!mapped.empty()) {
+            scaled.push_back(mapped);
+        }
+    }
+    return scaled;
+}
+
+cv::Mat applyEnhancements(const cv::Mat& image, const EnhanceOptions& options, const ProgressCallback& progress, PipelinePlan* chosenPlan, const StageImageCallback& stageImage) {
+    return applyEnhancements(image.clone(), options, progress, chosenPlan, stageImage);
+}
+
+cv::Mat applyEnhancements(cv::Mat&& image, const EnhanceOptions& options, const ProgressCallback& progress, PipelinePlan* chosenPlan, const StageImageCallback& stageImage) {
+    PipelinePlan plan = planPipeline(options, image.size());
+    const bool tiled = useTiledExecution(image.size());
+    if (tiled) {
+        plan.notes.push_back("tiled execution in " + std::to_string(stripRows(image, 0)) + "-row strips");
+    }
+    std::cout << "[Plan] " << plan.describe() << " (est. cost " << plan.estimatedCost
+              << ", " << plan.resampleCount << " resamples, predicted "
+              << plan.predictedSeconds * 1000 << " ms)" << std::endl;
+    if (options.deadlineMs > 0) {
+        std::cout << "[Plan] Deadline leaves " << plan.deadlineSeconds * 1000 << " ms for the steps" << std::endl;
+    }
+    for (const std::string& note : plan.notes) {
+        std::cout << "[Plan] " << note << std::endl;
+    }
+
+    // A stage starts with its first step and finishes with its last one.
+    std::map<std::string, std::size_t> lastStepOfStage;
+    for (std::size_t i = 0; i < plan.steps.size(); ++i) {
+        lastStepOfStage[plan.steps[i].stage] = i;
+    }
+
+    const cv::Size inputSize = image.size();
+    cv::Mat enhanced = std::move(image);
+    double workingScale = 1.0;
+    std::vector<cv::Rect> faces;
+    double facesScale = 1.0;
+    std::set<std::string> startedStages;
+    for (std::size_t i = 0; i < plan.steps.size(); ++i) {
+        const PlannedStep& step = plan.steps[i];
+        if (startedStages.insert(step.stage).second) {
+            reportProgress(progress, step.stage, 0.0);
+        }
+
+        auto stepStart = std::chrono::steady_clock::now();
+        switch (step.kind) {
+        case StepKind::Sharpen:
+            sharpenImage(enhanced, tiled);
+            break;
+        case StepKind::Resample: {
+            cv::Size targetSize = step.scale == 1.0 ? inputSize
+                                                    : cv::Size(cvRound(inputSize.width * step.scale), cvRound(inputSize.height * step.scale));
+            resampleImage(enhanced, targetSize, step.interpolation);
+            break;
+        }
+        case StepKind::Denoise: {
+            const std::string& stage = step.stage;
+            denoiseImage(enhanced, step.network, tiled, [&progress, &stage](double tiles) {
+                reportProgress(progress, stage, tiles);
+            });
+            break;
+        }
+        case StepKind::ColorCorrection:
+            correctColor(enhanced, options);
+            break;
+        case StepKind::DetectFaces: {
+            std::cout << "[Enhance] Applying face beautify (skin smoothing)..." << std::endl;
+            DetectionProxy proxy = makeDetectionProxy(enhanced, step.scale, step.maxSide);
+            faces = detectFaces(proxy, step.scale, step.network);
+            facesScale = step.scale;
+            break;
+        }
+        case StepKind::SmoothFaces:
+            if (step.scale != facesScale) {
+                faces = rescaleFaces(faces, step.scale / facesScale, enhanced.size());
+                facesScale = step.scale;
+            }
+            smoothFaces(enhanced, faces);
+            break;
+        case StepKind::SuperResolve: {
+            const std::string& stage = step.stage;
+            const std::string& network = step.network;
+            const int factor = cvRound(step.scale / workingScale);
+            auto onTiles = [&progress, &stage](double tiles) {
+                reportProgress(progress, stage, tiles);
+            };
+            if (tiled) {
+                // The network's halo, and at least the 2 px bicubic chroma reaches.
+                int halo = std::max(superResolutionSettings().tileHalo, 2);
+                enhanced = upscaleInStrips(enhanced, factor, halo, [&network, factor](const cv::Mat& input) {
+                    return superResolve(input, network, factor);
+                }, onTiles);
+            } else {
+                enhanced = superResolve(enhanced, network, factor, onTiles);
+            }
+            break;
+        }
+        }
+        workingScale = step.scale;
+        plan.steps[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+        LatencyModel::instance().record(stepVariant(step), step.megapixels, inputSize.area() / 1e6, plan.steps[i].seconds);
+
+        if (lastStepOfStage[step.stage] == i) {
+            reportProgress(progress, step.stage, 1.0);
+            if (stageImage) {
+                stageImage(step.stage, enhanced);
+            }
+        }
+    }
+
+    for (const std::string& stage : plan.skippedStages) {
+        reportProgress(progress, stage, 1.0);
+    }
+
+    if (chosenPlan) {
+        *chosenPlan = std::move(plan);
+    }
+    return enhanced;
+}
+
+EncodedImage encodeImage(const cv::Mat& image, const std::string& outputFormat, int jpegQuality) {
+    EncodedImage result;
+    std::vector<int> params;
+    if (outputFormat == "png") {
+        result.contentType = "image/png";
+        result.extension = "png";
+        params = {cv::IMWRITE_PNG_COMPRESSION, 3}; // 0=none, 9=max
+    } else {
+        result.contentType = "image/jpeg";
+        result.extension = "jpg";
+        int quality = jpegQuality > 0 ? jpegQuality : 95;
+        params = {cv::IMWRITE_JPEG_QUALITY, quality};
+    }
+    std::vector<uchar> buffer;
+    if (!cv::imencode("." + result.extension, image, buffer, params)) {
+        std::cerr << "[Enhance] Error: Failed to encode enhanced image!" << std::endl;
+        return EncodedImage();
+    }
+    // imencode only fills a std::vector; this is the single copy before the bytes are moved into a response.
+    result.bytes.assign(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    std::cout << "[Enhance] Encoded " << result.extension << " in memory: " << result.bytes.size() << " bytes" << std::endl;
+    return result;
+}
@@ -0,0 +1,75 @@
+﻿#include "Face_Beautify.h"
+#include "Guided_Filter.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+// 1 inside [low, high], falling linearly to 0 over `soft` levels outside it.
+float ramp(int value, int low, int high, int soft) {
+    if (value < low) {
+        return std::max(0.0f, 1.0f - (float)(low - value) / soft);
+    }
+    if (value > high) {
+        return std::max(0.0f, 1.0f - (float)(value - high) / soft);
+    }
+    return 1.0f;
+}
+
+// Probability-like skin weight from the chroma of each pixel, using the usual YCrCb skin box
+// (Cr 133-173, Cb 77-127) with soft edges, then feathered so the blend has no visible seams.
+cv::Mat skinMask(const cv::Mat& face, int radius) {
+    static const struct Weights {
+        float cr[256];
+        float cb[256];
+        Weights() {
+            for (int v = 0; v < 256; ++v) {
+                cr[v] = ramp(v, 133, 173, 10);
+                cb[v] = ramp(v, 77, 127, 10);
+            }
+        }
+    } weights;
+
+    cv::Mat ycrcb;
+    cv::cvtColor(face, ycrcb, cv::COLOR_BGR2YCrCb);
+    cv::Mat mask(face.size(), CV_32FC1);
+    for (int y = 0; y < face.rows; ++y) {
+        const uchar* src = ycrcb.ptr<uchar>(y);
+        float* dst = mask.ptr<float>(y);
+        for (int x = 0; x < face.cols; ++x) {
+            dst[x] = weights.cr[src[3 * x + 1]] * weights.cb[src[3 * x + 2]];
+        }
+    }
+    cv::boxFilter(mask, mask, -1, cv::Size(2 * radius + 1, 2 * radius + 1));
+    return mask;
+}
+
+cv::Mat beautifyFace(const cv::Mat& face, const BeautifyParameters& params) {
+    const int radius = std::max(params.minRadius, cvRound(face.cols * params.radiusFraction));
+    cv::Mat input;
+    face.convertTo(input, CV_32F, 1.0 / 255.0);
+    cv::Mat smooth = guidedFilter(input, radius, params.eps);
+
+    cv::Mat mask = skinMask(face, radius);
+    cv::Mat mask3;
+    cv::merge(std::vector<cv::Mat>{mask, mask, mask}, mask3);
+    cv::Mat change = smooth - input;
+    cv::Mat blended = input + change.mul(mask3);
+    cv::Mat result;
+    blended.convertTo(result, CV_8U, 255.0);
+    return result;
+}
+
+} // namespace
+
+void beautifyFaces(cv::Mat& image, const std::vector<cv::Rect>& faces, const BeautifyParameters& params) {
+    std::vector<cv::Mat> results(faces.size());
+    cv::parallel_for_(cv::Range(0, (int)faces.size()), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            results[i] = beautifyFace(image(faces[i]), params);
+        }
+    });
+    for (std::size_t i = 0; i < faces.size(); ++i) {
+        results[i].copyTo(image(faces[i]));
+    }
+}
@@ -0,0 +1,21 @@
+﻿// Face_Beautify.h : Skin smoothing inside face rects with a guided filter and a skin mask.
+
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct BeautifyParameters {
+    double radiusFraction = 0.02;  // Filter radius as a fraction of the face width
+    int minRadius = 4;             // ...but at least this many pixels
+    double eps = 0.025;            // Guided filter regularization on [0, 1] intensities; edges
+                                   // with a local variance well above it are kept
+};
+
+// Smooths the skin of every face in `faces` (rects inside `image`, a BGR image) in place.
+// Each face is filtered with a self-guided filter, which is a handful of box filters and so
+// costs the same per pixel whatever the radius, and the result is blended in through a
+// feathered skin-colour mask, so hair, eyes, lips and background inside the rect keep their
+// detail. Faces are filtered in parallel on OpenCV's worker threads from the unmodified image
+// and written back in order, so where rects overlap the later face wins.
+void beautifyFaces(cv::Mat& image, const std::vector<cv::Rect>& faces, const BeautifyParameters& params = BeautifyParameters());
@@ -0,0 +1,166 @@
+﻿#include "Face_Detection.h"
+#include "Model_Registry.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+
+static FaceDetectionSettings settings_;
+
+// Side of the frontal face cascade's detection window; smaller faces cannot be found.
+static constexpr int CascadeWindow = 24;
+
+void configureFaceDetection(const FaceDetectionSettings& settings) {
+    settings_ = settings;
+    settings_.maxProxySide = std::max(settings_.maxProxySide, 256);
+    settings_.minFaceSize = std::max(settings_.minFaceSize, CascadeWindow);
+    if (settings_.detector != "haar" && settings_.detector != "yunet") {
+        std::cerr << "[Faces] Unknown face detector '" << settings_.detector << "', using haar" << std::endl;
+        settings_.detector = "haar";
+    }
+}
+
+const FaceDetectionSettings& faceDetectionSettings() {
+    return settings_;
+}
+
+bool registerYuNetFaceDetector(const std::string& path) {
+    if (!std::filesystem::exists(path)) {
+        std::cout << "[Faces] No YuNet model at " << path << ", the yunet detector falls back to haar" << std::endl;
+        return false;
+    }
+    ModelRegistry::instance().registerFaceDetector(ModelRegistry::FaceYuNet, path);
+    return true;
+}
+
+static double proxyScale(cv::Size imageSize, double imageScale, int maxSide) {
+    maxSide = maxSide > 0 ? maxSide : settings_.maxProxySide;
+    int longest = std::max(imageSize.width, imageSize.height);
+    if (longest <= maxSide) {
+        return 1.0;
+    }
+    double scale = (double)maxSide / longest;
+    // Never shrink a minimum-size face below the cascade window.
+    double minFace = settings_.minFaceSize * imageScale;
+    return std::min(1.0, std::max(scale, CascadeWindow / minFace));
+}
+
+const cv::Mat& DetectionProxy::grayImage() {
+    if (gray.empty()) {
+        cv::cvtColor(color, gray, cv::COLOR_BGR2GRAY);
+    }
+    return gray;
+}
+
+DetectionProxy makeDetectionProxy(const cv::Mat& image, double imageScale, int maxSide) {
+    DetectionProxy proxy;
+    proxy.imageSize = image.size();
+    proxy.scale = proxyScale(image.size(), imageScale, maxSide);
+    if (proxy.scale < 1.0) {
+        cv::resize(image, proxy.color, cv::Size(), proxy.scale, proxy.scale, cv::INTER_AREA);
+    } else {
+        proxy.color = image;
+    }
+    return proxy;
+}
+
+double detectionProxyMegapixels(cv::Size inputSize, double imageScale, int maxSide) {
+    cv::Size imageSize(cvRound(inputSize.width * imageScale), cvRound(inputSize.height * imageScale));
+    double scale = proxyScale(imageSize, imageScale, maxSide);
+    return (double)imageSize.width * imageSize.height * scale * scale / 1e6;
+}
+
+namespace {
+
+// Viola-Jones cascade on the grayscale proxy. Frontal faces only.
+class HaarFaceDetector : public FaceDetector {
+public:
+    std::vector<cv::Rect> detect(DetectionProxy& proxy, int minFace) const override {
+        std::vector<cv::Rect> faces;
+        // Preloaded at startup; each thread gets its own classifier instance.
+        cv::CascadeClassifier* face_cascade = ModelRegistry::instance().cascade(ModelRegistry::FaceCascade);
+        if (!face_cascade) {
+            std::cerr << "[Enhance] Could not load face cascade for beautify!" << std::endl;
+            return faces;
+        }
+        face_cascade->detectMultiScale(proxy.grayImage(), faces, 1.1, 3, 0, cv::Size(minFace, minFace));
+        return faces;
+    }
+};
+
+// YuNet CNN through cv::FaceDetectorYN on the colour proxy. One forward pass at the proxy size
+// instead of a scale pyramid, and it also finds rotated and profile faces.
+class YuNetFaceDetector : public FaceDetector {
+public:
+    std::vector<cv::Rect> detect(DetectionProxy& proxy, int minFace) const override {
+        std::vector<cv::Rect> faces;
+        cv::FaceDetectorYN* yunet = ModelRegistry::instance().faceDetector(ModelRegistry::FaceYuNet);
+        if (!yunet) {
+            std::cerr << "[Enhance] Could not load YuNet face detector for beautify!" << std::endl;
+            return faces;
+        }
+        yunet->setInputSize(proxy.color.size());
+        yunet->setScoreThreshold(settings_.yunetScoreThreshold);
+        cv::Mat detections;
+        yunet->detect(proxy.color, detections);
+        // One row per face: x, y, width, height, five landmarks and the score.
+        for (int i = 0; i < detections.rows; ++i) {
+            const float* row = detections.ptr<float>(i);
+            cv::Rect face(cvRound(row[0]), cvRound(row[1]), cvRound(row[2]), cvRound(row[3]));
+            if (std::min(face.width, face.height) >= minFace) {
+                faces.push_back(face);
+            }
+        }
+        return faces;
+    }
+};
+
+} // namespace
+
+const FaceDetector* faceDetector(const std::string& name) {
+    static const HaarFaceDetector haar;
+    static const YuNetFaceDetector yunet;
+    if (name == "haar") {
+        return ModelRegistry::instance().hasModel(ModelRegistry::FaceCascade) ? &haar : nullptr;
+    }
+    if (name == "yunet") {
+        return ModelRegistry::instance().hasModel(ModelRegistry::FaceYuNet) ? &yunet : nullptr;
+    }
+    return nullptr;
+}
+
+FaceDetectorChoice chooseFaceDetector(const std::string& requested) {
+    FaceDetectorChoice choice;
+    choice.name = requested.empty() ? settings_.detector : requested;
+    if (choice.name != "haar" && faceDetector(choice.name) == nullptr) {
+        choice.note = "face detector " + choice.name + " not loaded, using haar";
+        choice.name = "haar";
+    }
+    return choice;
+}
+
+std::vector<cv::Rect> detectFaces(DetectionProxy& proxy, double imageScale, const std::string& detector) {
+    std::vector<cv::Rect> mapped;
+    const FaceDetector* backend = faceDetector(detector);
+    if (!backend) {
+        std::cerr << "[Enhance] Face detector '" << detector << "' is not available!" << std::endl;
+        return mapped;
+    }
+    int minFace = std::max(CascadeWindow, cvRound(settings_.minFaceSize * imageScale * proxy.scale));
+    std::vector<cv::Rect> faces = backend->detect(proxy, minFace);
+
+    // Back to image coordinates, clipped to the image.
+    const cv::Rect bounds(0, 0, proxy.imageSize.width, proxy.imageSize.height);
+    const double factor = 1.0 / proxy.scale;
+    for (const cv::Rect& face : faces) {
+        cv::Rect rect(cvRound(face.x * factor), cvRound(face.y * factor), cvRound(face.width * factor), cvRound(face.height * factor));
+        rect = rect & bounds;
+        if (!rect.empty()) {
+            mapped.push_back(rect);
+        }
+    }
+    std::cout << "[Enhance] " << detector << " detected " << mapped.size() << " faces on a " << proxy.color.cols << "x"
+              << proxy.color.rows << " proxy of " << proxy.imageSize.width << "x" << proxy.imageSize.height << std::endl;
+    return mapped;
+}
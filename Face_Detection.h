@@ -0,0 +1,71 @@
+﻿// Face_Detection.h : Pluggable face detectors run on a bounded-size proxy of the working image.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Deployment-wide settings, set once at startup before any job runs.
+struct FaceDetectionSettings {
+    int maxProxySide = 1024;        // Longest side of the image detection runs on
+    int minFaceSize = 80;           // Smallest face searched for, in input image pixels
+    std::string detector = "haar";  // Backend for requests that do not name one: "haar" or "yunet"
+    float yunetScoreThreshold = 0.9f; // Confidence below which YuNet detections are dropped
+};
+
+void configureFaceDetection(const FaceDetectionSettings& settings);
+const FaceDetectionSettings& faceDetectionSettings();
+
+// Registers the YuNet ONNX model at `path` with the ModelRegistry. Returns false if the file does
+// not exist, in which case requests for "yunet" fall back to the cascade; a broken file throws
+// std::runtime_error.
+bool registerYuNetFaceDetector(const std::string& path);
+
+// A copy of an image shrunk so its longest side is at most a given size (maxProxySide unless the
+// plan picked a smaller one), unless that would make a minimum-size face smaller than the
+// cascade's window.
+struct DetectionProxy {
+    cv::Mat color;          // BGR; the image itself when it needed no shrinking
+    cv::Mat gray;           // Built on first use by a backend that wants it
+    double scale = 1.0;     // Proxy pixels per image pixel, at most 1
+    cv::Size imageSize;     // Size of the image it was made from
+
+    bool empty() const { return color.empty(); }
+    const cv::Mat& grayImage();
+};
+
+// Builds the proxy of `image`, which is at `imageScale` times the input resolution, with a
+// longest side of at most `maxSide` (0 for maxProxySide).
+DetectionProxy makeDetectionProxy(const cv::Mat& image, double imageScale, int maxSide = 0);
+
+// Input pixels covered by the proxy of an image of `inputSize` at `imageScale`, for cost estimates.
+double detectionProxyMegapixels(cv::Size inputSize, double imageScale, int maxSide = 0);
+
+// A face detection backend. Backends fetch this thread's model instance from the ModelRegistry,
+// so one backend object serves every thread.
+class FaceDetector {
+public:
+    virtual ~FaceDetector() = default;
+
+    // Faces in proxy coordinates, none smaller than `minFace` proxy pixels.
+    virtual std::vector<cv::Rect> detect(DetectionProxy& proxy, int minFace) const = 0;
+};
+
+// The backend named `name` ("haar" or "yunet"), or nullptr if the name is unknown or the
+// backend's model is not loaded.
+const FaceDetector* faceDetector(const std::string& name);
+
+// What the pipeline will actually run for a request's face detector.
+struct FaceDetectorChoice {
+    std::string name;  // "haar" or "yunet"
+    std::string note;  // Why the request was downgraded, empty if it was not
+};
+
+// Resolves a request's detector: empty means the deployment default, and a backend whose model
+// is not loaded falls back to the cascade.
+FaceDetectorChoice chooseFaceDetector(const std::string& requested);
+
+// Runs the named backend on `proxy` and returns the faces in the coordinates of the image it was
+// made from. `imageScale` maps the minimum face size from input pixels to that image.
+std::vector<cv::Rect> detectFaces(DetectionProxy& proxy, double imageScale, const std::string& detector);
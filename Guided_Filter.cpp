@@ -0,0 +1,50 @@
+﻿#include "Guided_Filter.h"
+#include <algorithm>
+#include <atomic>
+#include <opencv2/imgproc.hpp>
+
+cv::Mat guidedFilter(const cv::Mat& image, int radius, double eps) {
+    const cv::Size window(2 * radius + 1, 2 * radius + 1);
+    cv::Mat mean, meanSquare;
+    cv::boxFilter(image, mean, -1, window);
+    cv::boxFilter(image.mul(image), meanSquare, -1, window);
+    cv::Mat variance = meanSquare - mean.mul(mean);
+    cv::Mat a = variance + cv::Scalar::all(eps);
+    cv::divide(variance, a, a);
+    cv::Mat b = mean - a.mul(mean);
+    cv::boxFilter(a, a, -1, window);
+    cv::boxFilter(b, b, -1, window);
+    return a.mul(image) + b;
+}
+
+cv::Mat denoiseGuided(const cv::Mat& image, const GuidedDenoiseParameters& params, const std::function<void(double)>& onProgress) {
+    const int halo = params.halo();
+    const int rows = std::max(64, halo);
+    const int stripCount = (image.rows + rows - 1) / rows;
+
+    // Strips read from `image` and write disjoint rows of `denoised`, so they need no locking.
+    cv::Mat denoised(image.size(), image.type());
+    std::atomic<int> stripsDone{0};
+    cv::parallel_for_(cv::Range(0, stripCount), [&](const cv::Range& range) {
+        for (int strip = range.start; strip < range.end; ++strip) {
+            const int first = strip * rows;
+            const int last = std::min(first + rows, image.rows);
+            // Clipping the halo at the image border leaves the box filters to extrapolate there,
+            // exactly as they do for a full-image call.
+            const int top = std::max(first - halo, 0);
+            const int bottom = std::min(last + halo, image.rows);
+
+            cv::Mat input;
+            image.rowRange(top, bottom).convertTo(input, CV_32F, 1.0 / 255.0);
+            cv::Mat filtered = guidedFilter(input, params.radius, params.eps);
+            cv::Mat core = denoised.rowRange(first, last);
+            filtered.rowRange(first - top, last - top).convertTo(core, image.depth(), 255.0);
+
+            int done = stripsDone.fetch_add(1) + 1;
+            if (onProgress) {
+                onProgress((double)done / stripCount);
+            }
+        }
+    });
+    return denoised;
+}
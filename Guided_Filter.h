@@ -0,0 +1,30 @@
+﻿// Guided_Filter.h : He et al.'s guided filter built from box filters, and a fast denoiser on top of it.
+
+#pragma once
+
+#include <functional>
+#include <opencv2/core.hpp>
+
+// Filters a floating-point image guided by itself, channel by channel: a local linear model
+// q = a * I + b whose slope a drops towards 0 (the local mean) where the variance is small next to
+// `eps` and stays near 1 (identity) across edges. Everything is box filters, so the cost per
+// pixel is the same for any radius. Each output pixel depends on the input within 2 * radius.
+cv::Mat guidedFilter(const cv::Mat& image, int radius, double eps);
+
+// Parameters of denoiseGuided.
+struct GuidedDenoiseParameters {
+    int radius = 2;       // Box filter radius
+    double eps = 1e-3;    // Regularization on [0, 1] intensities, about an 8-level standard deviation
+
+    // Pixels around an output pixel that its value depends on.
+    int halo() const { return 2 * radius; }
+};
+
+// Edge-preserving denoise of a BGR image with the self-guided filter: the fast alternative to
+// non-local means, linear in the pixel count and independent of the window size. The image is cut
+// into full-width strips extended by the halo and the strips run in parallel on OpenCV's worker
+// threads. Every output pixel sees the neighbourhood a single full-image call would give it, but
+// the float box sums start at a different row, so the result matches that call within rounding
+// (a level at most) rather than exactly. `onProgress` receives the fraction of strips done, from
+// worker threads.
+cv::Mat denoiseGuided(const cv::Mat& image, const GuidedDenoiseParameters& params, const std::function<void(double)>& onProgress = nullptr);
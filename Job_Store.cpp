@@ -0,0 +1,196 @@
+﻿#include "Job_Store.h"
+#include <algorithm>
+#include <functional>
+#include <random>
+
+const char* jobStateName(JobState state) {
+    switch (state) {
+    case JobState::Queued: return "queued";
+    case JobState::Running: return "running";
+    case JobState::Done: return "done";
+    case JobState::Failed: return "failed";
+    }
+    return "unknown";
+}
+
+Job::Job(std::string id, const std::vector<std::string>& stageNames)
+    : id_(std::move(id)) {
+    for (const std::string& name : stageNames) {
+        stages_.push_back({name, 0.0});
+    }
+}
+
+void Job::markRunning() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == JobState::Queued) {
+        state_ = JobState::Running;
+    }
+}
+
+void Job::setStageProgress(const std::string& stage, double progress) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (StageStatus& status : stages_) {
+        if (status.name == stage) {
+            status.progress = std::clamp(progress, 0.0, 1.0);
+            status.started = true;
+            return;
+        }
+    }
+}
+
+void Job::setPlan(std::string plan, std::vector<std::pair<std::string, std::string>> variants) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    plan_ = std::move(plan);
+    variants_ = std::move(variants);
+}
+
+void Job::setLatency(int deadlineMs, double elapsedMs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deadlineMs_ = deadlineMs;
+    elapsedMs_ = elapsedMs;
+}
+
+JobState Job::state() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_;
+}
+
+JobSnapshot Job::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    JobSnapshot snapshot;
+    snapshot.state = state_;
+    snapshot.stages = stages_;
+    snapshot.plan = plan_;
+    snapshot.variants = variants_;
+    snapshot.deadlineMs = deadlineMs_;
+    snapshot.elapsedMs = elapsedMs_;
+    snapshot.error = error_;
+    if (state_ == JobState::Done) {
+        snapshot.progress = 1.0;
+    } else if (!stages_.empty()) {
+        double total = 0.0;
+        for (const StageStatus& status : stages_) {
+            total += status.progress;
+        }
+        snapshot.progress = total / stages_.size();
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const EncodedImage> Job::result() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return result_;
+}
+
+JobStore::JobStore(std::size_t maxJobs, std::size_t maxBytes)
+    : maxJobsPerShard_(std::max<std::size_t>(1, maxJobs / ShardCount)),
+      maxBytesPerShard_(std::max<std::size_t>(1, maxBytes / ShardCount)) {
+}
+
+std::string JobStore::createJobId() {
+    // The ID is all that guards a job's result, so every bit comes from the OS CSPRNG behind
+    // std::random_device, not from a seeded generator whose outputs seen IDs would reveal.
+    thread_local std::random_device device;
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string id;
+    id.reserve(32);
+    for (int word = 0; word < 4; ++word) {
+        uint32_t bits = device();
+        for (int i = 0; i < 8; ++i) {
+            id.push_back(hexDigits[bits & 0xF]);
+            bits >>= 4;
+        }
+    }
+    return id;
+}
+
+std::shared_ptr<Job> JobStore::createJob(const std::vector<std::string>& stageNames) {
+    auto job = std::make_shared<Job>(createJobId(), stageNames);
+    Shard& shard = shardFor(job->id());
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.jobs.emplace(job->id(), job);
+    shard.insertionOrder.push_back(job->id());
+    evictLocked(shard);
+    return job;
+}
+
+std::shared_ptr<Job> JobStore::findJob(const std::string& jobId) const {
+    const Shard& shard = shardFor(jobId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.jobs.find(jobId);
+    return it != shard.jobs.end() ? it->second : nullptr;
+}
+
+void JobStore::completeJob(const std::shared_ptr<Job>& job, std::shared_ptr<const EncodedImage> result) {
+    Shard& shard = shardFor(job->id());
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::size_t resultBytes = result ? result->bytes.size() : 0;
+    {
+        std::lock_guard<std::mutex> jobLock(job->mutex_);
+        job->result_ = std::move(result);
+        job->state_ = JobState::Done;
+        for (StageStatus& status : job->stages_) {
+            status.progress = 1.0;
+            status.started = true;
+        }
+    }
+    // Only count the bytes while the job is still stored; an evicted job just holds its result
+    // until the last reader lets go of it.
+    if (shard.jobs.count(job->id())) {
+        shard.bytes += resultBytes;
+        evictLocked(shard, job->id());
+    }
+}
+
+void JobStore::failJob(const std::shared_ptr<Job>& job, const std::string& error) {
+    std::lock_guard<std::mutex> jobLock(job->mutex_);
+    job->state_ = JobState::Failed;
+    job->error_ = error;
+}
+
+std::shared_ptr<const EncodedImage> JobStore::getResult(const std::string& jobId) const {
+    std::shared_ptr<Job> job = findJob(jobId);
+    return job ? job->result() : nullptr;
+}
+
+std::size_t JobStore::size() const {
+    std::size_t total = 0;
+    for (const Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.jobs.size();
+    }
+    return total;
+}
+
+JobStore::Shard& JobStore::shardFor(const std::string& jobId) {
+    return shards_[std::hash<std::string>{}(jobId) % ShardCount];
+}
+
+const JobStore::Shard& JobStore::shardFor(const std::string& jobId) const {
+    return shards_[std::hash<std::string>{}(jobId) % ShardCount];
+}
+
+void JobStore::evictLocked(Shard& shard, const std::string& keepJobId) {
+    // Queued and running jobs are never evicted; their number is already capped by the compute queue.
+    auto it = shard.insertionOrder.begin();
+    while (it != shard.insertionOrder.end() &&
+           (shard.jobs.size() > maxJobsPerShard_ || shard.bytes > maxBytesPerShard_)) {
+        auto job = shard.jobs.find(*it);
+        if (job == shard.jobs.end()) {
+            it = shard.insertionOrder.erase(it);
+            continue;
+        }
+        JobState state = job->second->state();
+        if ((state != JobState::Done && state != JobState::Failed) || *it == keepJobId) {
+            ++it;
+            continue;
+        }
+        std::shared_ptr<const EncodedImage> result = job->second->result();
+        if (result) {
+            shard.bytes -= result->bytes.size();
+        }
+        std::cout << "[Jobs] Evicted job " << *it << std::endl;
+        shard.jobs.erase(job);
+        it = shard.insertionOrder.erase(it);
+    }
+}
@@ -0,0 +1,120 @@
+﻿// Job_Store.h : In-memory store for enhancement jobs and their results.
+
+#pragma once
+
+#include "Photo_Enhancer.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class JobState { Queued, Running, Done, Failed };
+
+// "queued", "running", "done" or "failed".
+const char* jobStateName(JobState state);
+
+// Progress of one pipeline stage, from 0 (not started) to 1 (finished).
+struct StageStatus {
+    std::string name;
+    double progress = 0.0;
+    bool started = false;
+};
+
+// A consistent copy of a job's state for reporting.
+struct JobSnapshot {
+    JobState state = JobState::Queued;
+    std::vector<StageStatus> stages;
+    double progress = 0.0; // Mean of the stage progress values
+    std::string plan;      // Pipeline plan summary, once the job has started
+    std::vector<std::pair<std::string, std::string>> variants; // Algorithm each stage ran, once enhanced
+    int deadlineMs = 0;    // The request's latency budget, 0 for none
+    double elapsedMs = 0.0; // From creation to the encoded result, once done
+    std::string error;
+};
+
+// One enhancement job. Workers update it while the pipeline runs and IO threads read
+// snapshots of it, so every accessor takes the job's own lock.
+class Job {
+public:
+    Job(std::string id, const std::vector<std::string>& stageNames);
+
+    const std::string& id() const { return id_; }
+    std::chrono::steady_clock::time_point createdAt() const { return createdAt_; }
+
+    void markRunning();
+    // Stages not listed at creation are ignored.
+    void setStageProgress(const std::string& stage, double progress);
+    void setPlan(std::string plan, std::vector<std::pair<std::string, std::string>> variants = {});
+    // Records how long the job took against the request's deadline (0 for none).
+    void setLatency(int deadlineMs, double elapsedMs);
+
+    JobState state() const;
+    JobSnapshot snapshot() const;
+    // Null until the job is done.
+    std::shared_ptr<const EncodedImage> result() const;
+
+private:
+    friend class JobStore;
+
+    const std::string id_;
+    const std::chrono::steady_clock::time_point createdAt_ = std::chrono::steady_clock::now();
+    mutable std::mutex mutex_;
+    JobState state_ = JobState::Queued;
+    std::vector<StageStatus> stages_;
+    std::string plan_;
+    std::vector<std::pair<std::string, std::string>> variants_;
+    int deadlineMs_ = 0;
+    double elapsedMs_ = 0.0;
+    std::string error_;
+    std::shared_ptr<const EncodedImage> result_;
+};
+
+// Jobs keyed by a generated job ID, so concurrent uploads never share state.
+// The map is split into shards with their own lock, and each shard evicts its oldest
+// finished jobs once it goes over its share of the job count or byte budget.
+class JobStore {
+public:
+    JobStore(std::size_t maxJobs, std::size_t maxBytes);
+
+    // Returns a new random 128-bit ID as 32 lowercase hex characters.
+    static std::string createJobId();
+
+    // Registers a queued job with a fresh ID and the given pipeline stages.
+    std::shared_ptr<Job> createJob(const std::vector<std::string>& stageNames);
+    // Returns nullptr for unknown or evicted jobs.
+    std::shared_ptr<Job> findJob(const std::string& jobId) const;
+
+    void completeJob(const std::shared_ptr<Job>& job, std::shared_ptr<const EncodedImage> result);
+    void failJob(const std::shared_ptr<Job>& job, const std::string& error);
+
+    // Returns nullptr for unknown, evicted or unfinished jobs.
+    std::shared_ptr<const EncodedImage> getResult(const std::string& jobId) const;
+
+    std::size_t size() const;
+
+private:
+    static constexpr std::size_t ShardCount = 16;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Job>> jobs;
+        std::deque<std::string> insertionOrder;
+        std::size_t bytes = 0;
+    };
+
+    Shard& shardFor(const std::string& jobId);
+    const Shard& shardFor(const std::string& jobId) const;
+    // Drops the oldest finished jobs, except keepJobId, until the shard is within budget.
+    // Caller holds shard.mutex.
+    void evictLocked(Shard& shard, const std::string& keepJobId = std::string());
+
+    std::size_t maxJobsPerShard_;
+    std::size_t maxBytesPerShard_;
+    std::array<Shard, ShardCount> shards_;
+};
@@ -0,0 +1,54 @@
+﻿#include "Latency_Model.h"
+#include <cstdlib>
+
+// Seconds per megapixel of a weight-1 step (a Gaussian sharpen pass) on a typical core count.
+static constexpr double PriorSecondsPerWeightedMegapixel = 0.01;
+// Weight of the newest measurement in the moving average.
+static constexpr double Smoothing = 0.2;
+
+static constexpr double MegapixelEdges[] = {1, 4, 12, 24, 48};
+
+LatencyModel& LatencyModel::instance() {
+    static LatencyModel model;
+    return model;
+}
+
+int LatencyModel::bucket(double imageMegapixels) {
+    int index = 0;
+    while (index < BucketCount - 1 && imageMegapixels >= MegapixelEdges[index]) {
+        ++index;
+    }
+    return index;
+}
+
+double LatencyModel::predict(const std::string& variant, double megapixels, double imageMegapixels, double priorWeight) const {
+    const int wanted = bucket(imageMegapixels);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = estimates_.find(variant);
+        if (it != estimates_.end()) {
+            // The measured bucket closest to the image size.
+            int nearest = -1;
+            for (int index = 0; index < BucketCount; ++index) {
+                if (it->second[index].samples > 0 && (nearest < 0 || std::abs(index - wanted) < std::abs(nearest - wanted))) {
+                    nearest = index;
+                }
+            }
+            if (nearest >= 0) {
+                return it->second[nearest].secondsPerMegapixel * megapixels;
+            }
+        }
+    }
+    return priorWeight * PriorSecondsPerWeightedMegapixel * megapixels;
+}
+
+void LatencyModel::record(const std::string& variant, double megapixels, double imageMegapixels, double seconds) {
+    if (megapixels <= 0.0) {
+        return;
+    }
+    const double rate = seconds / megapixels;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Estimate& estimate = estimates_[variant][bucket(imageMegapixels)];
+    estimate.secondsPerMegapixel = estimate.samples == 0 ? rate : estimate.secondsPerMegapixel + Smoothing * (rate - estimate.secondsPerMegapixel);
+    ++estimate.samples;
+}
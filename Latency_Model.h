@@ -0,0 +1,39 @@
+﻿// Latency_Model.h : Seconds per megapixel of each step variant, learned from measured step times.
+
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cost model for deadline planning. Each step variant ("denoise(nlm)",
+// "superResolve(ESPCN_x2)", "encode(png)", ...) keeps a moving average of its seconds per
+// megapixel in each image-size bucket, since fixed overheads make small images costlier per
+// pixel. Until a variant has been measured in a bucket, predictions fall back to its nearest
+// measured bucket and then to a prior derived from the planner's relative step weights.
+class LatencyModel {
+public:
+    static LatencyModel& instance();
+
+    // Predicted seconds for `variant` processing `megapixels`, in an image of `imageMegapixels`.
+    // `priorWeight` is the planner's weight for the step, used while nothing was measured.
+    double predict(const std::string& variant, double megapixels, double imageMegapixels, double priorWeight) const;
+
+    // Feeds one measured run of `variant` into the model.
+    void record(const std::string& variant, double megapixels, double imageMegapixels, double seconds);
+
+private:
+    LatencyModel() = default;
+
+    static constexpr int BucketCount = 6; // <1, 1-4, 4-12, 12-24, 24-48, 48+ MP
+    static int bucket(double imageMegapixels);
+
+    struct Estimate {
+        double secondsPerMegapixel = 0.0;
+        int samples = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::array<Estimate, BucketCount>> estimates_;
+};
@@ -0,0 +1,201 @@
+﻿#include "Mat_Pool.h"
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Transparent huge page size on x86-64 and most arm64 kernels.
+constexpr std::size_t HugePageBytes = 2 << 20;
+
+// Set in UMatData::allocatorFlags_ for buffers that come from the pool.
+constexpr int PooledFlag = 1;
+
+MatPool* installed_ = nullptr;
+
+// Size class of a request: rounded up to a quarter of its highest power of two.
+std::size_t classCapacity(std::size_t bytes) {
+    std::size_t step = std::size_t(1) << (std::bit_width(bytes) - 3);
+    return (bytes + step - 1) / step * step;
+}
+
+} // namespace
+
+MatPool::MatPool(const MatPoolSettings& settings) : settings_(settings) {
+    settings_.minPooledBytes = std::max<std::size_t>(settings_.minPooledBytes, 64 << 10);
+}
+
+MatPool::~MatPool() {
+    trim();
+}
+
+cv::UMatData* MatPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag, cv::UMatUsageFlags) const {
+    // Same layout as OpenCV's standard allocator: dense rows, innermost dimension last.
+    std::size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i) {
+        if (step) {
+            if (data && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            }
+            else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->size = total;
+    if (data) {
+        u->data = u->origdata = static_cast<uchar*>(data);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+    if (total < settings_.minPooledBytes) {
+        u->data = u->origdata = static_cast<uchar*>(cv::fastMalloc(total));
+        return u;
+    }
+
+    const std::size_t capacity = classCapacity(total);
+    void* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = freeBuffers_.find(capacity);
+        if (found != freeBuffers_.end() && !found->second.empty()) {
+            buffer = found->second.back();
+            found->second.pop_back();
+            stats_.retainedBytes -= capacity;
+            ++stats_.hits;
+        }
+        else {
+            ++stats_.misses;
+        }
+        stats_.inUseBytes += capacity;
+    }
+    if (!buffer) {
+        try {
+            buffer = allocateBuffer(capacity);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.inUseBytes -= capacity;
+            delete u;
+            throw;
+        }
+    }
+    u->data = u->origdata = static_cast<uchar*>(buffer);
+    u->allocatorFlags_ = PooledFlag;
+    return u;
+}
+
+bool MatPool::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void MatPool::deallocate(cv::UMatData* u) const {
+    if (!u) {
+        return;
+    }
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        if (u->allocatorFlags_ & PooledFlag) {
+            const std::size_t capacity = classCapacity(u->size);
+            bool keep = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.inUseBytes -= capacity;
+                keep = stats_.retainedBytes + capacity <= settings_.retainedBytes;
+                if (keep) {
+                    freeBuffers_[capacity].push_back(u->origdata);
+                    stats_.retainedBytes += capacity;
+                }
+                else {
+                    ++stats_.releases;
+                }
+            }
+            if (!keep) {
+                freeBuffer(u->origdata, capacity);
+            }
+        }
+        else {
+            cv::fastFree(u->origdata);
+        }
+        u->origdata = nullptr;
+    }
+    delete u;
+}
+
+MatPoolStats MatPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void MatPool::trim() {
+    std::unordered_map<std::size_t, std::vector<void*>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers.swap(freeBuffers_);
+        stats_.retainedBytes = 0;
+    }
+    for (auto& [capacity, list] : buffers) {
+        for (void* buffer : list) {
+            freeBuffer(buffer, capacity);
+        }
+    }
+}
+
+void MatPool::install(const MatPoolSettings& settings) {
+    if (settings.retainedBytes == 0 || installed_) {
+        return;
+    }
+    installed_ = new MatPool(settings);
+    cv::Mat::setDefaultAllocator(installed_);
+    std::cout << "[MatPool] Retaining up to " << (settings.retainedBytes >> 20) << " MiB of image buffers"
+              << (settings.hugePages ? " on huge pages" : "") << std::endl;
+}
+
+MatPool* MatPool::installed() {
+    return installed_;
+}
+
+void* MatPool::allocateBuffer(std::size_t capacity) const {
+#ifdef __linux__
+    if (settings_.hugePages && capacity >= HugePageBytes) {
+        // Map one huge page extra and trim to a 2 MiB boundary, so the whole buffer can be backed
+        // by huge pages; the kernel only collapses aligned ranges.
+        std::size_t mapped = capacity + HugePageBytes;
+        void* region = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            CV_Error(cv::Error::StsNoMem, "MatPool: out of memory");
+        }
+        std::uintptr_t start = reinterpret_cast<std::uintptr_t>(region);
+        std::uintptr_t aligned = (start + HugePageBytes - 1) & ~(std::uintptr_t)(HugePageBytes - 1);
+        if (aligned > start) {
+            munmap(region, aligned - start);
+        }
+        std::size_t tail = start + mapped - (aligned + capacity);
+        if (tail > 0) {
+            munmap(reinterpret_cast<void*>(aligned + capacity), tail);
+        }
+        madvise(reinterpret_cast<void*>(aligned), capacity, MADV_HUGEPAGE);
+        return reinterpret_cast<void*>(aligned);
+    }
+#endif
+    return cv::fastMalloc(capacity);
+}
+
+void MatPool::freeBuffer(void* buffer, std::size_t capacity) const {
+#ifdef __linux__
+    if (settings_.hugePages && capacity >= HugePageBytes) {
+        munmap(buffer, capacity);
+        return;
+    }
+#endif
+    (void)capacity;
+    cv::fastFree(buffer);
+}
@@ -0,0 +1,67 @@
+﻿// Mat_Pool.h : Recycles large cv::Mat buffers across jobs through a custom cv::MatAllocator.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Deployment-wide pool settings, applied once at startup.
+struct MatPoolSettings {
+    std::size_t retainedBytes = 256 << 20; // Free buffers kept for reuse; 0 leaves OpenCV's allocator in place
+    std::size_t minPooledBytes = 1 << 20;  // Smaller buffers go straight to cv::fastMalloc
+    bool hugePages = false;                // Back buffers of 2 MiB and up with transparent huge pages (Linux only)
+};
+
+struct MatPoolStats {
+    std::uint64_t hits = 0;        // Pooled allocations served by a retained buffer
+    std::uint64_t misses = 0;      // Pooled allocations that had to allocate a new buffer
+    std::uint64_t releases = 0;    // Freed buffers handed back to the system because the pool was full
+    std::size_t retainedBytes = 0; // Free buffers held for reuse
+    std::size_t inUseBytes = 0;    // Pooled buffers currently owned by Mats
+
+    double hitRate() const { return hits + misses > 0 ? (double)hits / (hits + misses) : 0.0; }
+};
+
+// A cv::MatAllocator that keeps freed buffers of at least minPooledBytes for the next Mat of the
+// same size class, instead of returning them to the system. The pipeline allocates the same few
+// image-sized buffers for every job (decode, blur, Lab planes, resize targets, ...), and with a
+// plain malloc each of those is a fresh mmap that page-faults on first touch and is unmapped on
+// release. Size classes are a quarter of a power of two apart, so a buffer is at most 25% larger
+// than requested and images of slightly different sizes share buffers. Small allocations bypass
+// the pool and its lock entirely.
+class MatPool : public cv::MatAllocator {
+public:
+    explicit MatPool(const MatPoolSettings& settings);
+    ~MatPool() override;
+
+    MatPool(const MatPool&) = delete;
+    MatPool& operator=(const MatPool&) = delete;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    MatPoolStats stats() const;
+    // Hands every retained buffer back to the system.
+    void trim();
+
+    // Makes a process-wide pool OpenCV's default allocator, so every Mat created afterwards on
+    // any thread draws from it. Does nothing when retainedBytes is 0. The pool is never destroyed,
+    // as Mats allocated from it may live until exit.
+    static void install(const MatPoolSettings& settings);
+    // The installed pool, or nullptr.
+    static MatPool* installed();
+
+private:
+    void* allocateBuffer(std::size_t capacity) const;
+    void freeBuffer(void* buffer, std::size_t capacity) const;
+
+    MatPoolSettings settings_;
+    mutable std::mutex mutex_;
+    mutable std::unordered_map<std::size_t, std::vector<void*>> freeBuffers_; // By capacity
+    mutable MatPoolStats stats_;
+};
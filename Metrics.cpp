@@ -0,0 +1,153 @@
+﻿#include "Metrics.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+static constexpr int StageCount = (int)MetricStage::Count;
+static constexpr int OutcomeCount = (int)JobOutcome::Count;
+static constexpr int FormatCount = 2;
+static constexpr int MegapixelBucketCount = 6;
+
+static const char* const StageLabels[StageCount] = {
+    "queue_wait", "decode", "sharpen", "denoise", "colorCorrection", "superResolution", "beautify", "encode", "respond"};
+static const char* const OutcomeLabels[OutcomeCount] = {"done", "failed", "rejected"};
+static const char* const FormatLabels[FormatCount] = {"png", "jpeg"};
+static const char* const MegapixelLabels[MegapixelBucketCount] = {"0-1", "1-4", "4-12", "12-24", "24-48", "48+"};
+static const double MegapixelEdges[MegapixelBucketCount - 1] = {1, 4, 12, 24, 48};
+
+// Upper bounds in seconds; a final implicit bucket catches everything slower.
+static const double LatencyBounds[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+static constexpr int LatencyBucketCount = sizeof(LatencyBounds) / sizeof(LatencyBounds[0]) + 1;
+
+struct Histogram {
+    std::array<std::atomic<std::uint64_t>, LatencyBucketCount> buckets{};
+    std::atomic<std::uint64_t> sumNanos{0};
+};
+
+// One thread's share of every series. Only its owner writes it; scrapes read it concurrently.
+struct Shard {
+    std::array<Histogram, StageCount * FormatCount * MegapixelBucketCount> histograms;
+    std::array<std::atomic<std::uint64_t>, OutcomeCount> jobs{};
+};
+
+static std::mutex shardsMutex;
+// Shards outlive their threads: the compute and IO pools live as long as the process, so the
+// list only grows by the number of threads ever started.
+static std::vector<std::unique_ptr<Shard>> shards;
+
+static Shard& localShard() {
+    thread_local Shard* shard = [] {
+        auto created = std::make_unique<Shard>();
+        Shard* raw = created.get();
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        shards.push_back(std::move(created));
+        return raw;
+    }();
+    return *shard;
+}
+
+static int histogramIndex(int stage, int format, int megapixels) {
+    return (stage * FormatCount + format) * MegapixelBucketCount + megapixels;
+}
+
+MetricLabels MetricLabels::forJob(const std::string& outputFormat, double megapixels) {
+    MetricLabels labels;
+    labels.format = outputFormat == "png" ? 0 : 1;
+    while (labels.megapixels < MegapixelBucketCount - 1 && megapixels >= MegapixelEdges[labels.megapixels]) {
+        ++labels.megapixels;
+    }
+    return labels;
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::observe(MetricStage stage, const MetricLabels& labels, double seconds) {
+    int bucket = 0;
+    while (bucket < LatencyBucketCount - 1 && seconds > LatencyBounds[bucket]) {
+        ++bucket;
+    }
+    Histogram& histogram = localShard().histograms[histogramIndex((int)stage, labels.format, labels.megapixels)];
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.sumNanos.fetch_add((std::uint64_t)(seconds * 1e9), std::memory_order_relaxed);
+}
+
+void Metrics::countJob(JobOutcome outcome) {
+    localShard().jobs[(int)outcome].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Metrics::stageFromName(const std::string& name, MetricStage& stage) {
+    for (int i = 0; i < StageCount; ++i) {
+        if (name == StageLabels[i]) {
+            stage = (MetricStage)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Metrics::renderPrometheus() const {
+    // Sum the shards first so the output is built without holding the lock.
+    std::vector<std::array<std::uint64_t, LatencyBucketCount>> buckets(StageCount * FormatCount * MegapixelBucketCount);
+    std::vector<std::uint64_t> sumNanos(buckets.size());
+    std::array<std::uint64_t, OutcomeCount> jobs{};
+    {
+        std::lock_guard<std::mutex> lock(shardsMutex);
+        for (const auto& shard : shards) {
+            for (std::size_t h = 0; h < buckets.size(); ++h) {
+                for (int b = 0; b < LatencyBucketCount; ++b) {
+                    buckets[h][b] += shard->histograms[h].buckets[b].load(std::memory_order_relaxed);
+                }
+                sumNanos[h] += shard->histograms[h].sumNanos.load(std::memory_order_relaxed);
+            }
+            for (int o = 0; o < OutcomeCount; ++o) {
+                jobs[o] += shard->jobs[o].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::ostringstream text;
+    text << "# HELP photo_enhancer_jobs_total Enhancement jobs by outcome.\n";
+    text << "# TYPE photo_enhancer_jobs_total counter\n";
+    for (int o = 0; o < OutcomeCount; ++o) {
+        text << "photo_enhancer_jobs_total{outcome=\"" << OutcomeLabels[o] << "\"} " << jobs[o] << "\n";
+    }
+
+    text << "# HELP photo_enhancer_stage_duration_seconds Time spent in each phase of a job.\n";
+    text << "# TYPE photo_enhancer_stage_duration_seconds histogram\n";
+    for (int s = 0; s < StageCount; ++s) {
+        for (int f = 0; f < FormatCount; ++f) {
+            for (int m = 0; m < MegapixelBucketCount; ++m) {
+                int h = histogramIndex(s, f, m);
+                std::uint64_t count = 0;
+                for (std::uint64_t n : buckets[h]) {
+                    count += n;
+                }
+                if (count == 0) {
+                    continue;
+                }
+                std::string labels = std::string("stage=\"") + StageLabels[s] + "\",format=\"" + FormatLabels[f] + "\",megapixels=\"" + MegapixelLabels[m] + "\"";
+                std::uint64_t cumulative = 0;
+                for (int b = 0; b < LatencyBucketCount; ++b) {
+                    cumulative += buckets[h][b];
+                    text << "photo_enhancer_stage_duration_seconds_bucket{" << labels << ",le=\"";
+                    if (b < LatencyBucketCount - 1) {
+                        text << LatencyBounds[b];
+                    } else {
+                        text << "+Inf";
+                    }
+                    text << "\"} " << cumulative << "\n";
+                }
+                text << "photo_enhancer_stage_duration_seconds_sum{" << labels << "} " << sumNanos[h] / 1e9 << "\n";
+                text << "photo_enhancer_stage_duration_seconds_count{" << labels << "} " << count << "\n";
+            }
+        }
+    }
+    return text.str();
+}
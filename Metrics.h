@@ -0,0 +1,50 @@
+﻿// Metrics.h : Per-thread counters and latency histograms, exported in Prometheus text format.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Timed phases of a job, from waiting in the compute queue to handing the response back.
+enum class MetricStage {
+    QueueWait,
+    Decode,
+    Sharpen,
+    Denoise,
+    ColorCorrection,
+    SuperResolution,
+    Beautify,
+    Encode,
+    Respond,    // From the finished result to the response being handed to Crow on its IO thread
+    Count
+};
+
+enum class JobOutcome { Done, Failed, Rejected, Count };
+
+// Labels shared by every observation of one job, as bucket indices so recording does no string work.
+struct MetricLabels {
+    int format = 0;     // 0 = png, 1 = jpeg
+    int megapixels = 0; // Index into the megapixel buckets: <1, 1-4, 4-12, 12-24, 24-48, 48+
+
+    static MetricLabels forJob(const std::string& outputFormat, double megapixels);
+};
+
+// Process-wide metrics. Each thread records into its own shard with relaxed atomic adds, so the
+// hot path takes no lock and never contends with other threads; a scrape sums all shards.
+// Recording costs a thread_local lookup, a bucket search over a few bounds and two adds.
+class Metrics {
+public:
+    static Metrics& instance();
+
+    void observe(MetricStage stage, const MetricLabels& labels, double seconds);
+    void countJob(JobOutcome outcome);
+
+    // Maps a pipeline stage name ("denoise", ...) to its metric stage. False for unknown names.
+    static bool stageFromName(const std::string& name, MetricStage& stage);
+
+    // All non-empty series in Prometheus text exposition format.
+    std::string renderPrometheus() const;
+
+private:
+    Metrics() = default;
+};
@@ -0,0 +1,185 @@
+﻿#include "Model_Registry.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Reads a whole file into memory; throws if it cannot be opened.
+static std::string readModelFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Model file not found: " + path);
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Builds a cascade from XML held in memory. Returns false if it does not parse.
+static bool loadCascadeFromMemory(const std::string& xml, cv::CascadeClassifier& classifier) {
+    cv::FileStorage storage(xml, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    if (!storage.isOpened()) {
+        return false;
+    }
+    return classifier.read(storage.getFirstTopLevelNode()) && !classifier.empty();
+}
+
+// Builds a CPU network from ONNX bytes held in memory. Returns an empty Net if it does not parse.
+static cv::dnn::Net loadNetworkFromMemory(const std::string& onnx) {
+    cv::dnn::Net net;
+    try {
+        net = cv::dnn::readNetFromONNX(onnx.data(), onnx.size());
+    }
+    catch (const cv::Exception&) {
+        return cv::dnn::Net();
+    }
+    net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+    return net;
+}
+
+// Builds a CPU YuNet detector from ONNX bytes held in memory. Returns nullptr if it does not parse.
+static cv::Ptr<cv::FaceDetectorYN> loadFaceDetectorFromMemory(const std::string& onnx) {
+    std::vector<uchar> buffer(onnx.begin(), onnx.end());
+    try {
+        return cv::FaceDetectorYN::create("onnx", buffer, std::vector<uchar>(), cv::Size(320, 320), 0.9f, 0.3f, 5000,
+                                          cv::dnn::DNN_BACKEND_OPENCV, cv::dnn::DNN_TARGET_CPU);
+    }
+    catch (const cv::Exception&) {
+        return nullptr;
+    }
+}
+
+ModelRegistry& ModelRegistry::instance() {
+    static ModelRegistry registry;
+    return registry;
+}
+
+void ModelRegistry::registerCascade(const std::string& name, const std::string& path) {
+    auto model = std::make_shared<ModelFile>();
+    model->path = path;
+    model->contents = readModelFile(path);
+
+    cv::CascadeClassifier probe;
+    if (!loadCascadeFromMemory(model->contents, probe)) {
+        throw std::runtime_error("Invalid cascade file: " + path);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    model->generation = nextGeneration_++;
+    models_[name] = std::move(model);
+    std::cout << "[Models] Loaded cascade '" << name << "' from " << path << std::endl;
+}
+
+void ModelRegistry::registerNetwork(const std::string& name, const std::string& path) {
+    auto model = std::make_shared<ModelFile>();
+    model->path = path;
+    model->contents = readModelFile(path);
+
+    if (loadNetworkFromMemory(model->contents).empty()) {
+        throw std::runtime_error("Invalid ONNX network: " + path);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    model->generation = nextGeneration_++;
+    models_[name] = std::move(model);
+    std::cout << "[Models] Loaded network '" << name << "' from " << path << std::endl;
+}
+
+void ModelRegistry::registerFaceDetector(const std::string& name, const std::string& path) {
+    auto model = std::make_shared<ModelFile>();
+    model->path = path;
+    model->contents = readModelFile(path);
+
+    if (!loadFaceDetectorFromMemory(model->contents)) {
+        throw std::runtime_error("Invalid face detector network: " + path);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    model->generation = nextGeneration_++;
+    models_[name] = std::move(model);
+    std::cout << "[Models] Loaded face detector '" << name << "' from " << path << std::endl;
+}
+
+bool ModelRegistry::hasModel(const std::string& name) const {
+    return findModel(name) != nullptr;
+}
+
+cv::CascadeClassifier* ModelRegistry::cascade(const std::string& name) {
+    struct ThreadCascade {
+        unsigned generation = 0;
+        cv::CascadeClassifier classifier;
+    };
+    thread_local std::unordered_map<std::string, ThreadCascade> threadCascades;
+
+    std::shared_ptr<const ModelFile> model = findModel(name);
+    if (!model) {
+        return nullptr;
+    }
+    ThreadCascade& local = threadCascades[name];
+    if (local.generation != model->generation) {
+        // Already validated at registration, so this only fails if memory runs out.
+        local.classifier = cv::CascadeClassifier();
+        if (!loadCascadeFromMemory(model->contents, local.classifier)) {
+            std::cerr << "[Models] Could not instantiate cascade '" << name << "'" << std::endl;
+            threadCascades.erase(name);
+            return nullptr;
+        }
+        local.generation = model->generation;
+    }
+    return &local.classifier;
+}
+
+cv::dnn::Net* ModelRegistry::network(const std::string& name) {
+    struct ThreadNetwork {
+        unsigned generation = 0;
+        cv::dnn::Net net;
+    };
+    thread_local std::unordered_map<std::string, ThreadNetwork> threadNetworks;
+
+    std::shared_ptr<const ModelFile> model = findModel(name);
+    if (!model) {
+        return nullptr;
+    }
+    ThreadNetwork& local = threadNetworks[name];
+    if (local.generation != model->generation) {
+        local.net = loadNetworkFromMemory(model->contents);
+        if (local.net.empty()) {
+            std::cerr << "[Models] Could not instantiate network '" << name << "'" << std::endl;
+            threadNetworks.erase(name);
+            return nullptr;
+        }
+        local.generation = model->generation;
+    }
+    return &local.net;
+}
+
+cv::FaceDetectorYN* ModelRegistry::faceDetector(const std::string& name) {
+    struct ThreadFaceDetector {
+        unsigned generation = 0;
+        cv::Ptr<cv::FaceDetectorYN> detector;
+    };
+    thread_local std::unordered_map<std::string, ThreadFaceDetector> threadDetectors;
+
+    std::shared_ptr<const ModelFile> model = findModel(name);
+    if (!model) {
+        return nullptr;
+    }
+    ThreadFaceDetector& local = threadDetectors[name];
+    if (local.generation != model->generation) {
+        local.detector = loadFaceDetectorFromMemory(model->contents);
+        if (!local.detector) {
+            std::cerr << "[Models] Could not instantiate face detector '" << name << "'" << std::endl;
+            threadDetectors.erase(name);
+            return nullptr;
+        }
+        local.generation = model->generation;
+    }
+    return local.detector.get();
+}
+
+std::shared_ptr<const ModelRegistry::ModelFile> ModelRegistry::findModel(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = models_.find(name);
+    return it != models_.end() ? it->second : nullptr;
+}
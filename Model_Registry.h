@@ -0,0 +1,66 @@
+﻿// Model_Registry.h : Loads model files once at startup and hands out per-thread instances.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <opencv2/dnn.hpp>
+#include <opencv2/objdetect.hpp>
+
+// Process-wide registry of the models the pipeline uses. Model files are read and validated
+// once at startup, so a missing or broken file stops the server at boot instead of failing
+// every request. None of cv::CascadeClassifier, cv::dnn::Net and cv::FaceDetectorYN is safe to share across
+// threads, so each thread gets its own instance, built from the in-memory copy the first time
+// that thread asks.
+class ModelRegistry {
+public:
+    // Name of the frontal face cascade used by beautify.
+    static constexpr const char* FaceCascade = "faceCascade";
+    // Name of the YuNet face detection network, the alternative beautify backend.
+    static constexpr const char* FaceYuNet = "faceYuNet";
+
+    static ModelRegistry& instance();
+
+    // Reads a Haar/LBP cascade XML file into memory and checks that it parses.
+    // Throws std::runtime_error if the file is missing or not a valid cascade.
+    void registerCascade(const std::string& name, const std::string& path);
+
+    // Reads an ONNX network into memory and checks that cv::dnn can build it.
+    // Throws std::runtime_error if the file is missing or not a valid network.
+    void registerNetwork(const std::string& name, const std::string& path);
+
+    // Reads a YuNet ONNX face detector into memory and checks that cv::FaceDetectorYN accepts it.
+    // Throws std::runtime_error if the file is missing or not a valid network.
+    void registerFaceDetector(const std::string& name, const std::string& path);
+
+    bool hasModel(const std::string& name) const;
+
+    // This thread's instance of the named cascade, or nullptr if it was never registered.
+    cv::CascadeClassifier* cascade(const std::string& name);
+
+    // This thread's instance of the named network, set up for the OpenCV CPU backend,
+    // or nullptr if it was never registered.
+    cv::dnn::Net* network(const std::string& name);
+
+    // This thread's instance of the named YuNet detector, on the CPU, or nullptr if it was never
+    // registered. Callers set the input size before each detect.
+    cv::FaceDetectorYN* faceDetector(const std::string& name);
+
+private:
+    ModelRegistry() = default;
+
+    struct ModelFile {
+        std::string path;
+        std::string contents;
+        unsigned generation = 0; // Bumped on re-registration so threads rebuild their instance
+    };
+
+    // Snapshot of a registered file; nullptr if unknown.
+    std::shared_ptr<const ModelFile> findModel(const std::string& name) const;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const ModelFile>> models_;
+    unsigned nextGeneration_ = 1;
+};
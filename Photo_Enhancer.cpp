@@ -1,228 +1,1098 @@
 ﻿#include "Photo_Enhancer.h"
+#include "Job_Store.h"
+#include "Latency_Model.h"
+#include "Compute_Pool.h"
+#include "Face_Detection.h"
+#include "Server_Config.h"
+#include "Mat_Pool.h"
+#include "Model_Registry.h"
+#include "Pipeline_Planner.h"
+#include "Super_Resolution.h"
+#include "Tiled_Execution.h"
+#include "Metrics.h"
+#include "Progress_Hub.h"
+#include "Result_Cache.h"
+#include "Upload_Stream.h"
 #include <opencv2/opencv.hpp>
 #include "Crow/crow.h"
 #include <thread>   // For sleep_for
 #include <chrono>   // For time duration
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <charconv>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string_view>
 #include <opencv2/objdetect.hpp>
 
-void enhanceImage(const std::string& inputPath, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality) {
-    std::cout << "[Enhance] Input: " << inputPath << ", Output: " << outputPath << std::endl;
-    cv::Mat image = cv::imread(inputPath);
-    if (image.empty()) {
-        std::cerr << "[Enhance] Error: Cannot load image!" << std::endl;
-        return;
+// Fills EnhanceOptions from the parsed "options" JSON, keeping defaults for missing fields.
+static EnhanceOptions parseEnhanceOptions(const crow::json::rvalue& json) {
+    EnhanceOptions options;
+    options.sharpen = json.has("sharpen") && json["sharpen"].b();
+    options.denoise = json.has("denoise") && json["denoise"].b();
+    options.colorCorrection = json.has("colorCorrection") && json["colorCorrection"].b();
+    options.superResolution = json.has("superResolution") && json["superResolution"].b();
+    options.beautify = json.has("beautify") && json["beautify"].b();
+    if (json.has("superResolutionModel") && json["superResolutionModel"].t() == crow::json::type::String) {
+        std::string model = std::string(json["superResolutionModel"].s());
+        if (model == "espcn" || model == "fsrcnn" || model == "bicubic") {
+            options.superResolutionModel = model;
+        }
+    }
+    if (json.has("superResolutionScale") && json["superResolutionScale"].t() == crow::json::type::Number) {
+        options.superResolutionScale = std::clamp((int)json["superResolutionScale"].i(), 2, 4);
+    }
+    if (json.has("denoiseMode") && json["denoiseMode"].t() == crow::json::type::String) {
+        std::string mode = std::string(json["denoiseMode"].s());
+        if (mode == "nlm" || mode == "fast") {
+            options.denoiseMode = mode;
+        }
+    }
+    if (json.has("faceDetector") && json["faceDetector"].t() == crow::json::type::String) {
+        std::string detector = std::string(json["faceDetector"].s());
+        if (detector == "haar" || detector == "yunet") {
+            options.faceDetector = detector;
+        }
+    }
+    if (json.has("claheClipLimit") && json["claheClipLimit"].t() == crow::json::type::Number) {
+        options.claheClipLimit = std::clamp(json["claheClipLimit"].d(), 0.0, 40.0);
+    }
+    if (json.has("claheTileGrid")) {
+        // Either one number for a square grid or [across, down].
+        const crow::json::rvalue& grid = json["claheTileGrid"];
+        if (grid.t() == crow::json::type::Number) {
+            options.claheTileGrid = cv::Size((int)grid.i(), (int)grid.i());
+        } else if (grid.t() == crow::json::type::List && grid.size() == 2 && grid[0].t() == crow::json::type::Number
+                   && grid[1].t() == crow::json::type::Number) {
+            options.claheTileGrid = cv::Size((int)grid[0].i(), (int)grid[1].i());
+        }
+        options.claheTileGrid.width = std::clamp(options.claheTileGrid.width, 1, 64);
+        options.claheTileGrid.height = std::clamp(options.claheTileGrid.height, 1, 64);
+    }
+    if (json.has("deadlineMs") && json["deadlineMs"].t() == crow::json::type::Number) {
+        options.deadlineMs = std::max((int)json["deadlineMs"].i(), 0);
+    }
+    if (json.has("outputFormat")) {
+        options.outputFormat = std::string(json["outputFormat"].s());
+    }
+    if (json.has("jpegQuality") && json["jpegQuality"].t() == crow::json::type::Number) {
+        options.jpegQuality = json["jpegQuality"].i();
     }
+    return options;
+}
 
-    cv::Mat enhanced = image.clone();
-
-    if (sharpen) {
-        std::cout << "[Enhance] Applying adaptive sharpen..." << std::endl;
-        cv::Mat blurred;
-        float alpha = 0.7f; // Less aggressive sharpening
-        cv::GaussianBlur(enhanced, blurred, cv::Size(0, 0), 2);
-        cv::addWeighted(enhanced, 1 + alpha, blurred, -alpha, 0, enhanced);
-        std::cout << "[Enhance] Sharpen applied." << std::endl;
-    }
-
-    if (denoise) {
-        std::cout << "[Enhance] Applying tuned denoise..." << std::endl;
-        // Downscale large images for faster denoising
-        int maxDenoiseDim = 1600;
-        cv::Mat denoiseInput = enhanced;
-        cv::Size origSize = enhanced.size();
-        bool wasDownscaled = false;
-        if (origSize.width > maxDenoiseDim || origSize.height > maxDenoiseDim) {
-            double scale = std::min((double)maxDenoiseDim / origSize.width, (double)maxDenoiseDim / origSize.height);
-            cv::resize(enhanced, denoiseInput, cv::Size(), scale, scale, cv::INTER_AREA);
-            wasDownscaled = true;
-            std::cout << "[Enhance] Downscaled for denoise: " << denoiseInput.cols << "x" << denoiseInput.rows << std::endl;
-        }
-        // Use faster parameters
-        cv::fastNlMeansDenoisingColored(denoiseInput, denoiseInput, 2, 2, 5, 11);
-        std::cout << "[Enhance] Denoise applied." << std::endl;
-        // Upscale back if needed
-        if (wasDownscaled) {
-            cv::resize(denoiseInput, enhanced, origSize, 0, 0, cv::INTER_CUBIC);
-            std::cout << "[Enhance] Upscaled denoised image back to original size: " << origSize.width << "x" << origSize.height << std::endl;
-        } else {
-            enhanced = denoiseInput;
+// The pieces of a multipart upload that the job routes need.
+struct UploadRequest {
+    // Set when Crow streamed the body into a MultipartUploadStream, which then owns the file
+    // bytes or the spill file they went to.
+    std::shared_ptr<MultipartUploadStream> stream;
+    std::size_t fileIndex = 0; // Which of the stream's files, for POST /api/batch
+    // The file bytes in memory, viewed in place in the stream or the request body; empty when
+    // spilled. Jobs that outlive the request call detachFromRequest first.
+    std::string_view fileBytes;
+    std::string ownedFileBytes;
+    EnhanceOptions options;
+    bool persistUpload = false;
+    bool inlineResult = false;
+    std::string cacheKey; // ResultCache key of the file bytes + options
+
+    UploadRequest() = default;
+    UploadRequest(const UploadRequest&) = delete; // fileBytes may point into ownedFileBytes
+    UploadRequest& operator=(const UploadRequest&) = delete;
+
+    bool spilled() const { return stream && stream->spilled(fileIndex); }
+
+    // Copies buffered file bytes out of the request body, which Crow reuses once the handler
+    // returns. Streamed uploads already own their bytes.
+    void detachFromRequest() {
+        if (stream) {
+            return;
         }
+        ownedFileBytes.assign(fileBytes);
+        fileBytes = ownedFileBytes;
+    }
+};
+
+// Body of the multipart part with this name, viewed in place; empty if there is no such part.
+// Unlike message_view::get_part_by_name this does not copy the part's header map either.
+static std::string_view multipartField(const crow::multipart::message_view& message, std::string_view name) {
+    auto found = message.part_map.find(name);
+    return found != message.part_map.end() ? found->second.body : std::string_view();
+}
+
+// Fills the options of `upload` from the body of the "options" part. On failure fills `error`
+// and returns false.
+static bool parseUploadOptions(std::string_view optionsBody, UploadRequest& upload, crow::response& error) {
+    // Check the "options" part
+    if (optionsBody.empty()) {
+        std::cerr << "Missing or empty 'options' field" << std::endl;
+        error = crow::response(400, "Missing or empty 'options' field");
+        return false;
+    }
+
+    // Parse JSON
+    auto json = crow::json::load(optionsBody.data(), optionsBody.size());
+    if (!json) {
+        std::cerr << "Invalid JSON format" << std::endl;
+        error = crow::response(400, "Invalid JSON format");
+        return false;
+    }
+
+    // Extract enhancement options
+    upload.options = parseEnhanceOptions(json);
+    upload.persistUpload = json.has("persistUpload") && json["persistUpload"].b();
+    upload.inlineResult = json.has("inline") && json["inline"].b();
+    return true;
+}
+
+// Extracts the "file" and "options" parts, either from the MultipartUploadStream the body was
+// streamed into or, for bodies Crow buffered, from req.body with a message_view. Buffered file
+// bytes stay in req.body, so `req` must outlive `upload` unless detachFromRequest is called.
+// On failure fills `error` and returns false.
+static bool parseUploadRequest(const crow::request& req, UploadRequest& upload, crow::response& error) {
+    auto stream = std::dynamic_pointer_cast<MultipartUploadStream>(req.streamed_body);
+    std::optional<crow::multipart::message_view> multipart;
+    bool hasFile = false;
+    std::string_view optionsBody;
+    if (stream) {
+        hasFile = stream->hasFile() && stream->fileSize() > 0;
+        optionsBody = stream->field("options");
+    }
+    else {
+        // Split the body into parts without copying them
+        multipart.emplace(req);
+        upload.fileBytes = multipartField(*multipart, "file");
+        hasFile = !upload.fileBytes.empty();
+        optionsBody = multipartField(*multipart, "options");
+    }
+
+    // Check the "file" part
+    if (!hasFile) {
+        std::cerr << "Missing or empty 'file' field" << std::endl;
+        error = crow::response(400, "Missing or empty 'file' field");
+        return false;
+    }
+
+    if (!parseUploadOptions(optionsBody, upload, error)) {
+        return false;
+    }
+    if (stream) {
+        // Hashed while it streamed in, so a spilled file is not read back for the cache key.
+        upload.fileBytes = stream->fileBytes();
+        upload.cacheKey = ResultCache::makeKey(stream->fileHash(), stream->fileSize(), upload.options);
+        upload.stream = std::move(stream);
+    }
+    else {
+        upload.cacheKey = ResultCache::makeKey(upload.fileBytes.data(), upload.fileBytes.size(), upload.options);
+    }
+    return true;
+}
+
+// Decodes the upload from memory, or from its spill file with cv::imread.
+static cv::Mat decodeUpload(const UploadRequest& upload) {
+    if (upload.spilled()) {
+        return decodeImageFile(upload.stream->spillPath(upload.fileIndex).string());
+    }
+    return decodeImage(upload.fileBytes.data(), upload.fileBytes.size());
+}
+
+// Stage names tracked for a job: decode, the enabled enhancement steps, then encode.
+static std::vector<std::string> jobStages(const EnhanceOptions& options) {
+    std::vector<std::string> stages = {"decode"};
+    for (const std::string& stage : pipelineStages(options)) {
+        stages.push_back(stage);
     }
+    stages.push_back("encode");
+    return stages;
+}
 
-    if (colorCorrection) {
-        std::cout << "[Enhance] Applying CLAHE-based color correction..." << std::endl;
-        cv::cvtColor(enhanced, enhanced, cv::COLOR_BGR2Lab);
-        std::vector<cv::Mat> labChannels(3);
-        cv::split(enhanced, labChannels);
+// The upload is decoded from memory; only keep a copy on disk when asked to.
+static void persistUploadIfRequested(const std::string& jobId, const UploadRequest& upload) {
+    if (!upload.persistUpload) {
+        return;
+    }
+    std::filesystem::create_directories("uploads/" + jobId);
+    std::string inputPath = "uploads/" + jobId + "/uploaded.jpg";
+    if (upload.spilled()) {
+        std::filesystem::copy_file(upload.stream->spillPath(upload.fileIndex), inputPath, std::filesystem::copy_options::overwrite_existing);
+        return;
+    }
+    std::ofstream outFile(inputPath, std::ios::binary);
+    outFile.write(upload.fileBytes.data(), upload.fileBytes.size());
+    outFile.close();
+}
+
+// Plan summary reported to clients, e.g. "sharpen@1x > ... > superResolve(ESPCN_x2)@2x (est. cost 41.2)".
+static std::string describePlan(const PipelinePlan& plan) {
+    std::ostringstream text;
+    text << plan.describe() << " (est. cost " << plan.estimatedCost << ")";
+    for (const std::string& note : plan.notes) {
+        text << "; " << note;
+    }
+    return text.str();
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
-        clahe->apply(labChannels[0], labChannels[0]);
+// Adds "variants" ({ stage: algorithm }) once the job has been enhanced and, for requests with a
+// deadlineMs that are done, "deadline": { budgetMs, elapsedMs, met }.
+static void addLatencyFields(crow::json::wvalue& json, const JobSnapshot& snapshot) {
+    for (const auto& [stage, variant] : snapshot.variants) {
+        json["variants"][stage] = variant;
+    }
+    if (snapshot.deadlineMs > 0 && snapshot.state == JobState::Done) {
+        json["deadline"]["budgetMs"] = snapshot.deadlineMs;
+        json["deadline"]["elapsedMs"] = snapshot.elapsedMs;
+        json["deadline"]["met"] = snapshot.elapsedMs <= snapshot.deadlineMs;
+    }
+}
 
-        cv::merge(labChannels, enhanced);
-        cv::cvtColor(enhanced, enhanced, cv::COLOR_Lab2BGR);
-        std::cout << "[Enhance] Color correction applied." << std::endl;
+// X-Deadline header value such as "met; 812 of 1000 ms", or empty without a deadline.
+static std::string deadlineHeader(const JobSnapshot& snapshot) {
+    if (snapshot.deadlineMs <= 0) {
+        return std::string();
     }
+    return std::string(snapshot.elapsedMs <= snapshot.deadlineMs ? "met" : "missed") + "; " + std::to_string(std::lround(snapshot.elapsedMs))
+         + " of " + std::to_string(snapshot.deadlineMs) + " ms";
+}
+
+// Longest side of the preview frames pushed to WebSocket clients.
+constexpr int PreviewMaxDim = 256;
+
+// A small JPEG of the working image for WebSocket previews.
+static std::string encodePreview(const cv::Mat& image) {
+    double scale = std::min(1.0, (double)PreviewMaxDim / std::max(image.cols, image.rows));
+    cv::Mat small;
+    cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    std::vector<uchar> buffer;
+    cv::imencode(".jpg", small, buffer, {cv::IMWRITE_JPEG_QUALITY, 70});
+    return std::string(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+}
 
-    if (superResolution) {
-        std::cout << "[Enhance] Applying super-resolution (interpolation)..." << std::endl;
-        // Alternatively load a DNN model like ESPCN_x2.onnx if available.
-        cv::resize(enhanced, enhanced, cv::Size(), 2.0, 2.0, cv::INTER_CUBIC);
-        std::cout << "[Enhance] Super-resolution applied." << std::endl;
+// Marks a job done with a cached result; completeJob reports every stage as finished.
+static void completeFromCache(const std::shared_ptr<Job>& job, JobStore& jobStore, ProgressHub& progressHub, std::shared_ptr<const EncodedImage> result, bool retainResult) {
+    job->setPlan("cache hit");
+    Metrics::instance().countJob(JobOutcome::Done);
+    jobStore.completeJob(job, retainResult ? std::move(result) : nullptr);
+    progressHub.jobFinished(job->id());
+    std::cout << "[Jobs] Job " << job->id() << " served from cache" << std::endl;
+}
+
+// Runs decode, enhancement and encode for a job on a compute thread, recording stage progress
+// and timings and pushing them to the job's WebSocket clients. A result found in the cache
+// (including its disk tier) is returned without processing, and a fresh result is added to it.
+// On success the job is marked done and the result returned; it is kept in the job store only if
+// retainResult is set. On failure the job is marked failed, errorStatus is set and nullptr
+// returned. `labels` receives the job's metric labels once the image is decoded.
+static std::shared_ptr<const EncodedImage> runJob(const std::shared_ptr<Job>& job, JobStore& jobStore, ProgressHub& progressHub, ResultCache& resultCache, const UploadRequest& upload, bool retainResult, int& errorStatus, MetricLabels& labels) {
+    // A deadline counts from when the job was created, so time spent queued is part of it.
+    EnhanceOptions options = upload.options;
+    options.startedAt = job->createdAt();
+    job->markRunning();
+    double queueWait = secondsSince(job->createdAt());
+    std::cout << "[Jobs] Job " << job->id() << " running" << std::endl;
+
+    if (std::shared_ptr<const EncodedImage> cached = resultCache.find(upload.cacheKey)) {
+        completeFromCache(job, jobStore, progressHub, cached, retainResult);
+        return cached;
     }
 
-    if (beautify) {
-        std::cout << "[Enhance] Applying face beautify (skin smoothing)..." << std::endl;
-        cv::CascadeClassifier face_cascade;
-        if (face_cascade.load("haarcascade_frontalface_default.xml")) {
-            std::vector<cv::Rect> faces;
-            cv::Mat gray;
-            cv::cvtColor(enhanced, gray, cv::COLOR_BGR2GRAY);
-            face_cascade.detectMultiScale(gray, faces, 1.1, 3, 0, cv::Size(80, 80));
-            for (const auto& face : faces) {
-                cv::Mat faceROI = enhanced(face);
-                cv::Mat smoothFace;
-                cv::bilateralFilter(faceROI, smoothFace, 9, 40, 40); // milder
-                smoothFace.copyTo(faceROI);
+    auto setProgress = [&job, &progressHub](const std::string& stage, double progress) {
+        job->setStageProgress(stage, progress);
+        progressHub.stageProgress(job->id(), stage, progress);
+    };
+    auto fail = [&](int status, const std::string& message) -> std::shared_ptr<const EncodedImage> {
+        errorStatus = status;
+        Metrics::instance().countJob(JobOutcome::Failed);
+        jobStore.failJob(job, message);
+        progressHub.jobFinished(job->id());
+        std::cerr << "[Jobs] Job " << job->id() << " failed: " << message << std::endl;
+        return nullptr;
+    };
+
+    try {
+        setProgress("decode", 0.0);
+        auto decodeStart = std::chrono::steady_clock::now();
+        cv::Mat image = decodeUpload(upload);
+        if (image.empty()) {
+            return fail(400, "Could not decode 'file' as an image");
+        }
+        setProgress("decode", 1.0);
+        const double inputMegapixels = image.total() / 1e6;
+        labels = MetricLabels::forJob(options.outputFormat, inputMegapixels);
+        Metrics::instance().observe(MetricStage::QueueWait, labels, queueWait);
+        Metrics::instance().observe(MetricStage::Decode, labels, secondsSince(decodeStart));
+
+        PipelinePlan plan;
+        // The decoded image is not needed afterwards, so the pipeline works on it in place.
+        cv::Mat enhanced = applyEnhancements(std::move(image), options, setProgress, &plan, [&job, &progressHub](const std::string&, const cv::Mat& stageImage) {
+            // Only pay for the resize and encode when someone is watching.
+            if (progressHub.wantsPreview(job->id())) {
+                progressHub.preview(job->id(), encodePreview(stageImage));
             }
-            std::cout << "[Enhance] Beautify applied to " << faces.size() << " faces." << std::endl;
+        });
+        job->setPlan(describePlan(plan), plan.variants());
+        for (const std::string& stage : plan.stageOrder()) {
+            MetricStage metricStage;
+            if (Metrics::stageFromName(stage, metricStage)) {
+                Metrics::instance().observe(metricStage, labels, plan.stageSeconds(stage));
+            }
+        }
+
+        setProgress("encode", 0.0);
+        auto encodeStart = std::chrono::steady_clock::now();
+        auto result = std::make_shared<EncodedImage>(encodeImage(enhanced, options.outputFormat, options.jpegQuality));
+        if (result->bytes.empty()) {
+            return fail(500, "Failed to encode enhanced image");
+        }
+        double encodeSeconds = secondsSince(encodeStart);
+        Metrics::instance().observe(MetricStage::Encode, labels, encodeSeconds);
+        LatencyModel::instance().record(encodeVariant(options.outputFormat), enhanced.total() / 1e6, inputMegapixels, encodeSeconds);
+        Metrics::instance().countJob(JobOutcome::Done);
+        job->setLatency(options.deadlineMs, secondsSince(job->createdAt()) * 1000.0);
+        // The cache key names the input and options, so it identifies these bytes as well; unless
+        // the result was downgraded to meet a deadline, which is not what the options alone would
+        // produce. Such a result stays out of the cache, and its ETag also names the downgrades.
+        if (plan.downgrades.empty()) {
+            result->etag = "\"" + upload.cacheKey + "\"";
+            resultCache.insert(upload.cacheKey, result);
         } else {
-            std::cerr << "[Enhance] Could not load face cascade for beautify!" << std::endl;
+            std::string downgrades;
+            for (const std::string& downgrade : plan.downgrades) {
+                downgrades += downgrade + ";";
+            }
+            std::ostringstream tag;
+            tag << std::hex << xxhash64(downgrades.data(), downgrades.size());
+            result->etag = "\"" + upload.cacheKey + "-d" + tag.str() + "\"";
+        }
+        jobStore.completeJob(job, retainResult ? result : nullptr);
+        progressHub.jobFinished(job->id());
+        std::cout << "[Jobs] Job " << job->id() << " done" << std::endl;
+        return result;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return fail(500, "Internal Server Error");
+    }
+}
+
+// Builds the synchronous /api/upload response for a finished job.
+static crow::response uploadResponse(const Job& job, const std::shared_ptr<const EncodedImage>& result, bool inlineResult) {
+    const std::string& jobId = job.id();
+    JobSnapshot snapshot = job.snapshot();
+    const std::string& plan = snapshot.plan;
+    if (inlineResult) {
+        // Return the image itself so the client can skip the GET /api/processed/<id> round trip.
+        // The bytes are shared with the result cache and written from there.
+        crow::response res(200);
+        res.set_header("X-Job-Id", jobId);
+        res.set_header("X-Pipeline-Plan", plan);
+        if (std::string deadline = deadlineHeader(snapshot); !deadline.empty()) {
+            res.set_header("X-Deadline", deadline);
+        }
+        res.set_shared_body(result, result->bytes.data(), result->bytes.size());
+        res.set_header("Content-Type", result->contentType);
+        res.set_header("Content-Disposition", "attachment; filename=enhanced_image." + result->extension);
+        if (!result->etag.empty()) {
+            res.set_header("ETag", result->etag);
+        }
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
+        res.set_header("Access-Control-Allow-Headers", "Content-Type");
+        res.set_header("Access-Control-Expose-Headers", "Content-Disposition, ETag, X-Job-Id, X-Pipeline-Plan, X-Deadline");
+        return res;
+    }
+
+    crow::json::wvalue responseBody;
+    responseBody["jobId"] = jobId;
+    responseBody["processedImageUrl"] = "/api/processed/" + jobId;
+    responseBody["plan"] = plan;
+    addLatencyFields(responseBody, snapshot);
+
+    crow::response res(200, responseBody);
+    res.set_header("Access-Control-Allow-Origin", "*");  // ✅ Allow all origins
+    res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
+    res.set_header("Access-Control-Allow-Headers", "Content-Type");
+    return res;
+}
+
+// Whether an If-None-Match header lists this entity tag. Weak tags match too, as the header
+// uses weak comparison.
+static bool matchesEntityTag(const std::string& ifNoneMatch, const std::string& etag) {
+    std::string_view list(ifNoneMatch);
+    while (!list.empty()) {
+        std::size_t comma = list.find(',');
+        std::string_view tag = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        while (!tag.empty() && tag.front() == ' ') {
+            tag.remove_prefix(1);
+        }
+        while (!tag.empty() && tag.back() == ' ') {
+            tag.remove_suffix(1);
+        }
+        if (tag.substr(0, 2) == "W/") {
+            tag.remove_prefix(2);
+        }
+        if (tag == "*" || tag == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A "bytes=first-last", "bytes=first-" or "bytes=-suffix" range of a body of `size` bytes.
+struct ByteRange {
+    std::size_t first = 0;
+    std::size_t last = 0;
+    bool satisfiable = true;
+};
+
+// Parses a single byte range. Returns false for anything else (several ranges, other units,
+// malformed values), in which case the Range header is ignored and the whole body sent.
+static bool parseByteRange(const std::string& header, std::size_t size, ByteRange& range) {
+    const std::string_view prefix = "bytes=";
+    std::string_view spec(header);
+    if (spec.substr(0, prefix.size()) != prefix) {
+        return false;
+    }
+    spec.remove_prefix(prefix.size());
+    std::size_t dash = spec.find('-');
+    if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos) {
+        return false;
+    }
+    auto parseNumber = [](std::string_view text, std::size_t& value) {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && error == std::errc() && end == text.data() + text.size();
+    };
+    std::string_view firstText = spec.substr(0, dash);
+    std::string_view lastText = spec.substr(dash + 1);
+
+    if (firstText.empty()) {
+        std::size_t suffix = 0;
+        if (!parseNumber(lastText, suffix)) {
+            return false;
         }
+        range.satisfiable = suffix > 0 && size > 0;
+        range.first = suffix < size ? size - suffix : 0;
+        range.last = size - 1;
+        return true;
+    }
+    if (!parseNumber(firstText, range.first)) {
+        return false;
     }
+    range.last = size - 1;
+    if (!lastText.empty()) {
+        if (!parseNumber(lastText, range.last) || range.last < range.first) {
+            return false;
+        }
+        range.last = std::min(range.last, size - 1);
+    }
+    range.satisfiable = range.first < size;
+    return true;
+}
 
-    std::vector<int> params;
-    std::string outPath = outputPath;
-    if (outputFormat == "png") {
-        outPath = "uploads/processed.png";
-        params = {cv::IMWRITE_PNG_COMPRESSION, 3}; // 0=none, 9=max
-    } else {
-        outPath = "uploads/processed.jpg";
-        int quality = jpegQuality > 0 ? jpegQuality : 95;
-        params = {cv::IMWRITE_JPEG_QUALITY, quality};
+// Serves a stored result for GET /api/jobs/<id>/result and /api/processed/<id>. The body is
+// written straight from the shared EncodedImage, never copied. A matching If-None-Match gets 304
+// with no body, and a single Range (unless If-Range names another version) gets 206.
+static crow::response resultResponse(const crow::request& req, const std::shared_ptr<const EncodedImage>& result) {
+    crow::response res;
+    res.set_header("Content-Type", result->contentType);
+    res.set_header("Content-Disposition", "attachment; filename=enhanced_image." + result->extension);
+    res.set_header("Accept-Ranges", "bytes");
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Access-Control-Allow-Methods", "GET, OPTIONS");
+    res.set_header("Access-Control-Expose-Headers", "Content-Disposition, ETag, Content-Range, Accept-Ranges");
+    const std::string& etag = result->etag;
+    if (!etag.empty()) {
+        res.set_header("ETag", etag);
+        // Results never change under their job ID, but clients revalidate so an evicted job is noticed.
+        res.set_header("Cache-Control", "private, no-cache");
+        if (matchesEntityTag(req.get_header_value("If-None-Match"), etag)) {
+            res.code = 304;
+            return res;
+        }
     }
-    bool success = cv::imwrite(outPath, enhanced, params);
-    if (!success) {
-        std::cerr << "[Enhance] Error: Failed to save enhanced image!" << std::endl;
-    } else {
-        std::cout << "[Enhance] Enhanced image saved: " << outPath << std::endl;
-        std::cout << "[Enhance] Output file size: " << std::filesystem::file_size(outPath) << " bytes" << std::endl;
+
+    const std::size_t size = result->bytes.size();
+    const std::string& rangeHeader = req.get_header_value("Range");
+    const std::string& ifRange = req.get_header_value("If-Range");
+    ByteRange range;
+    if (!rangeHeader.empty() && (ifRange.empty() || ifRange == etag) && parseByteRange(rangeHeader, size, range)) {
+        if (!range.satisfiable) {
+            res.code = 416;
+            res.set_header("Content-Range", "bytes */" + std::to_string(size));
+            return res;
+        }
+        res.code = 206;
+        res.set_header("Content-Range", "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" + std::to_string(size));
+        res.set_shared_body(result, result->bytes.data() + range.first, range.last - range.first + 1);
+        return res;
+    }
+    res.set_shared_body(result, result->bytes.data(), size);
+    return res;
+}
+
+// Job state and per-stage progress, as pushed over /ws/jobs/<id>.
+static crow::json::wvalue jobProgressJson(const Job& job) {
+    JobSnapshot snapshot = job.snapshot();
+    crow::json::wvalue status;
+    status["jobId"] = job.id();
+    status["state"] = jobStateName(snapshot.state);
+    status["progress"] = snapshot.progress;
+    std::vector<crow::json::wvalue> stages;
+    for (const StageStatus& stage : snapshot.stages) {
+        crow::json::wvalue entry;
+        entry["name"] = stage.name;
+        entry["progress"] = stage.progress;
+        entry["state"] = stage.progress >= 1.0 ? "done" : (stage.started ? "running" : "pending");
+        stages.push_back(std::move(entry));
+    }
+    status["stages"] = std::move(stages);
+    if (!snapshot.plan.empty()) {
+        status["plan"] = snapshot.plan;
+    }
+    addLatencyFields(status, snapshot);
+    if (snapshot.state == JobState::Done) {
+        status["resultUrl"] = "/api/jobs/" + job.id() + "/result";
+    }
+    if (snapshot.state == JobState::Failed) {
+        status["error"] = snapshot.error;
+    }
+    return status;
+}
+
+// Status document for GET /api/jobs/<id>: the progress document plus the compute queue.
+static crow::json::wvalue jobStatusJson(const Job& job, const ComputePool& computePool) {
+    crow::json::wvalue status = jobProgressJson(job);
+    status["queue"]["length"] = computePool.queued();
+    status["queue"]["capacity"] = computePool.maxQueued();
+    return status;
+}
+
+// What the WebSocket accept handler learns from the upgrade request, kept until the connection closes.
+struct WebSocketSubscriber {
+    std::shared_ptr<Job> job;
+    asio::io_context* ioContext = nullptr;
+    bool wantsPreview = false;
+};
+
+// Hands a response built on a compute thread back to the connection's IO thread and sends it.
+// The hand-off, including the wait for the IO thread, is recorded as the respond stage.
+static void completeOnIoThread(asio::io_context* ioContext, crow::response& res, crow::response&& result, const MetricLabels& labels) {
+    auto readyAt = std::chrono::steady_clock::now();
+    auto pending = std::make_shared<crow::response>(std::move(result));
+    asio::post(*ioContext, [&res, pending, labels, readyAt]() {
+        res = std::move(*pending);
+        res.end();
+        Metrics::instance().observe(MetricStage::Respond, labels, secondsSince(readyAt));
+    });
+}
+
+// A POST /api/batch response in progress. It is only touched on the connection's IO thread:
+// files are handed to the compute pool from there and each finished job posts back to write its
+// part, so no lock is needed.
+struct BatchRun {
+    std::shared_ptr<MultipartUploadStream> stream;
+    EnhanceOptions options;
+    bool persistUpload = false;
+    crow::response* res = nullptr;
+    asio::io_context* ioContext = nullptr;
+    std::string boundary;
+    std::size_t nextFile = 0;      // Next file to hand to the compute pool
+    std::size_t running = 0;       // Files handed over whose part is not written yet
+    std::size_t maxRunning = 1;    // Files of this batch allowed on the pool at once
+    std::size_t partsWritten = 0;
+    std::unique_ptr<asio::steady_timer> retryTimer; // Waits for room while other requests fill the queue
+};
+
+// Name of a batch result part: the uploaded file name without its path and extension, limited to
+// characters that are safe in a header, plus "_enhanced" and the result's extension.
+static std::string batchResultName(const std::string& uploadName, std::size_t index, const std::string& extension) {
+    std::string_view name(uploadName);
+    std::size_t slash = name.find_last_of("/\\");
+    if (slash != std::string_view::npos) {
+        name.remove_prefix(slash + 1);
+    }
+    name = name.substr(0, name.find_last_of('.'));
+    std::string stem;
+    for (char c : name) {
+        if (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.') {
+            stem += c;
+        }
+    }
+    if (stem.empty()) {
+        stem = "image_" + std::to_string(index);
+    }
+    return stem + "_enhanced." + extension;
+}
+
+// Writes the part for one finished file: the encoded image, or a JSON error document if its job
+// failed. The image bytes are written from the shared EncodedImage as they are.
+static void writeBatchPart(BatchRun& run, std::size_t index, const Job& job, const std::shared_ptr<const EncodedImage>& result, int errorStatus) {
+    JobSnapshot snapshot = job.snapshot();
+    // Each delimiter starts with the line break that ends the previous part.
+    std::string head = (run.partsWritten++ == 0 ? "--" : "\r\n--") + run.boundary + "\r\n";
+    std::string errorBody;
+    if (result) {
+        head += "Content-Type: " + result->contentType + "\r\n";
+        head += "Content-Disposition: attachment; name=\"result\"; filename=\"" + batchResultName(run.stream->fileName(index), index, result->extension) + "\"\r\n";
+        if (!result->etag.empty()) {
+            head += "ETag: " + result->etag + "\r\n";
+        }
+        head += "X-Pipeline-Plan: " + snapshot.plan + "\r\n";
+        if (std::string deadline = deadlineHeader(snapshot); !deadline.empty()) {
+            head += "X-Deadline: " + deadline + "\r\n";
+        }
+    }
+    else {
+        crow::json::wvalue error;
+        error["index"] = index;
+        error["jobId"] = job.id();
+        error["status"] = errorStatus;
+        error["error"] = snapshot.error;
+        errorBody = error.dump();
+        head += "Content-Type: application/json\r\n";
+        head += "Content-Disposition: attachment; name=\"error\"\r\n";
+    }
+    head += "X-Batch-Index: " + std::to_string(index) + "\r\n";
+    head += "X-Job-Id: " + job.id() + "\r\n\r\n";
+    run.res->write_chunk(head.data(), head.size());
+    if (result) {
+        run.res->write_chunk(result, result->bytes.data(), result->bytes.size());
+    }
+    else {
+        run.res->write_chunk(errorBody.data(), errorBody.size());
+    }
+}
+
+// Hands the batch's files to the compute pool, at most maxRunning at a time so one batch cannot
+// crowd out other requests, and ends the response after the last part. Called on the IO thread
+// when the batch starts and again whenever one of its files finishes.
+static void feedBatch(const std::shared_ptr<BatchRun>& run, JobStore& jobStore, ProgressHub& progressHub, ResultCache& resultCache, ComputePool& computePool) {
+    const std::size_t fileCount = run->stream->fileCount();
+    if (!run->res->is_alive()) {
+        // The client went away: start nothing more, and end once the running files are done.
+        run->nextFile = fileCount;
+    }
+    while (run->nextFile < fileCount && run->running < run->maxRunning) {
+        if (computePool.queued() >= computePool.maxQueued()) {
+            // Other requests filled the queue. Unlike a single upload the batch is already being
+            // answered, so wait for room instead of failing its files with 503; a running file
+            // feeds the batch again when it finishes.
+            if (run->running == 0) {
+                if (!run->retryTimer) {
+                    run->retryTimer = std::make_unique<asio::steady_timer>(*run->ioContext);
+                }
+                run->retryTimer->expires_after(std::chrono::milliseconds(50));
+                run->retryTimer->async_wait([run, &jobStore, &progressHub, &resultCache, &computePool](const std::error_code& error) {
+                    if (!error) {
+                        feedBatch(run, jobStore, progressHub, resultCache, computePool);
+                    }
+                });
+            }
+            return;
+        }
+
+        std::size_t index = run->nextFile++;
+        auto upload = std::make_shared<UploadRequest>();
+        upload->stream = run->stream;
+        upload->fileIndex = index;
+        upload->fileBytes = run->stream->fileBytes(index);
+        upload->options = run->options;
+        upload->persistUpload = run->persistUpload;
+        upload->cacheKey = ResultCache::makeKey(run->stream->fileHash(index), run->stream->fileSize(index), upload->options);
+
+        std::shared_ptr<Job> job = jobStore.createJob(jobStages(upload->options));
+        try {
+            persistUploadIfRequested(job->id(), *upload);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            jobStore.failJob(job, "Could not store the upload");
+            writeBatchPart(*run, index, *job, nullptr, 500);
+            continue;
+        }
+        if (std::shared_ptr<const EncodedImage> cached = resultCache.findInMemory(upload->cacheKey)) {
+            completeFromCache(job, jobStore, progressHub, cached, false);
+            writeBatchPart(*run, index, *job, cached, 200);
+            continue;
+        }
+
+        // Results are only written to this response, so jobs do not keep them in the job store.
+        bool queued = computePool.submit([run, job, upload, &jobStore, &progressHub, &resultCache, &computePool]() {
+            int errorStatus = 500;
+            MetricLabels labels = MetricLabels::forJob(upload->options.outputFormat, 0.0);
+            std::shared_ptr<const EncodedImage> result = runJob(job, jobStore, progressHub, resultCache, *upload, false, errorStatus, labels);
+            asio::post(*run->ioContext, [run, job, upload, result, errorStatus, &jobStore, &progressHub, &resultCache, &computePool]() {
+                --run->running;
+                writeBatchPart(*run, upload->fileIndex, *job, result, errorStatus);
+                feedBatch(run, jobStore, progressHub, resultCache, computePool);
+            });
+        });
+        if (!queued) {
+            // Lost a race for the last queue slot.
+            std::cerr << "[Jobs] Compute queue full, rejecting job " << job->id() << std::endl;
+            Metrics::instance().countJob(JobOutcome::Rejected);
+            jobStore.failJob(job, "Server busy");
+            writeBatchPart(*run, index, *job, nullptr, 503);
+            continue;
+        }
+        ++run->running;
+        std::cout << "[Jobs] Job " << job->id() << " queued (batch file " << index << ")" << std::endl;
+    }
+
+    if (run->running == 0 && run->nextFile >= fileCount) {
+        const std::string closing = (run->partsWritten == 0 ? "--" : "\r\n--") + run->boundary + "--\r\n";
+        run->res->write_chunk(closing.data(), closing.size());
+        run->res->end();
     }
 }
 
 int main() {
+    ServerConfig config = ServerConfig::fromEnvironment();
+
+    // Before any Mat is allocated, so image buffers are recycled from the first job on.
+    MatPool::install(config.matPoolSettings());
+    configureSuperResolution(config.superResolutionSettings());
+    configureTiledExecution(config.tiledExecutionSettings());
+    configureFaceDetection(config.faceDetectionSettings());
+    configureResultCacheModels(config.faceCascadePath + "," + config.superResolutionModelDir + "," + config.faceYuNetModelPath);
+
+    // Load every model up front so a missing file stops the server here rather than failing requests.
+    try {
+        ModelRegistry::instance().registerCascade(ModelRegistry::FaceCascade, config.faceCascadePath);
+        registerSuperResolutionNetworks(config.superResolutionModelDir);
+        registerYuNetFaceDetector(config.faceYuNetModelPath);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "[Models] " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Declared before the app so it outlives the WebSocket close handlers and posted flushes.
+    ProgressHub progressHub(jobProgressJson, std::chrono::milliseconds(100));
+
     crow::SimpleApp app;
 
+    // Jobs and results of recent uploads, keyed by job ID; the oldest finished jobs are dropped past the configured job count or byte budget.
+    JobStore jobStore(config.maxStoredJobs, config.maxStoredBytes);
+    // Finished results by input hash and options, so repeated uploads skip the pipeline.
+    ResultCache resultCache(config.resultCacheBytes, config.diskCacheBytes, config.diskCacheDir);
+    // Declared after the app so it is joined while the app's io_contexts are still alive.
+    ComputePool computePool(config.computeThreads, config.computeQueueDepth);
+
     // Ensure "uploads" directory exists
     std::filesystem::create_directories("uploads");
 
-    CROW_ROUTE(app, "/api/upload").methods(crow::HTTPMethod::Post)
-        ([](const crow::request& req) {
+    // Upload bodies are parsed as they arrive (Upload_Stream.h); large files spill to disk instead
+    // of growing the connection's memory. Spill files left by a previous run are never needed.
+    UploadStreamLimits uploadLimits;
+    uploadLimits.memoryBytes = config.uploadMemoryBytes;
+    std::error_code spillCleanup;
+    std::filesystem::remove_all(uploadLimits.spillDirectory, spillCleanup);
+    auto streamUpload = [uploadLimits](const crow::request& req) -> std::shared_ptr<crow::body_stream> {
+        return MultipartUploadStream::forRequest(req, uploadLimits);
+    };
+    UploadStreamLimits batchLimits = uploadLimits;
+    batchLimits.maxFiles = config.maxBatchFiles;
+    auto streamBatch = [batchLimits](const crow::request& req) -> std::shared_ptr<crow::body_stream> {
+        return MultipartUploadStream::forRequest(req, batchLimits);
+    };
 
-        try {
-            // Create a multipart message from the request
-            crow::multipart::message multipart(req);
+    CROW_ROUTE(app, "/api/upload").methods(crow::HTTPMethod::Post).max_body_size(config.maxUploadBytes).stream_body(streamUpload)
+        ([&jobStore, &computePool, &progressHub, &resultCache](const crow::request& req, crow::response& res) {
 
-            // Extract the "file" part
-            auto file_part = multipart.get_part_by_name("file");
-            if (file_part.body.empty()) {
-                std::cerr << "Missing or empty 'file' field" << std::endl;
-                return crow::response(400, "Missing or empty 'file' field");
+        try {
+            auto upload = std::make_shared<UploadRequest>();
+            if (!parseUploadRequest(req, *upload, res)) {
+                res.end();
+                return;
             }
 
-            std::string inputPath = "uploads/uploaded.jpg";
-            std::ofstream outFile(inputPath, std::ios::binary);
-            outFile.write(file_part.body.data(), file_part.body.size());
-            outFile.close();
+            std::shared_ptr<Job> job = jobStore.createJob(jobStages(upload->options));
+            persistUploadIfRequested(job->id(), *upload);
 
-            // Extract the "options" part
-            auto options_part = multipart.get_part_by_name("options");
-            if (options_part.body.empty()) {
-                std::cerr << "Missing or empty 'options' field" << std::endl;
-                return crow::response(400, "Missing or empty 'options' field");
+            // A memory hit is answered right here without touching the compute pool.
+            if (std::shared_ptr<const EncodedImage> cached = resultCache.findInMemory(upload->cacheKey)) {
+                completeFromCache(job, jobStore, progressHub, cached, !upload->inlineResult);
+                res = uploadResponse(*job, cached, upload->inlineResult);
+                res.end();
+                return;
             }
+            std::cout << "[Jobs] Job " << job->id() << " queued" << std::endl;
 
-            // Get the JSON string from the options part
-            std::string json_str = options_part.body;
-            if (json_str.empty()) {
-                std::cerr << "Empty 'options' field" << std::endl;
-                return crow::response(400, "Empty 'options' field");
+            // Decode, enhance and encode on a compute thread; this IO thread goes back to serving
+            // other connections and the response is completed once the job is done. The
+            // connection keeps `req` alive until then, so the upload is read in place.
+            asio::io_context* ioContext = req.io_context;
+            bool queued = computePool.submit([ioContext, &res, &jobStore, &progressHub, &resultCache, job, upload]() {
+                int errorStatus = 500;
+                MetricLabels labels = MetricLabels::forJob(upload->options.outputFormat, 0.0);
+                std::shared_ptr<const EncodedImage> result = runJob(job, jobStore, progressHub, resultCache, *upload, !upload->inlineResult, errorStatus, labels);
+                crow::response response = result ? uploadResponse(*job, result, upload->inlineResult)
+                                                 : crow::response(errorStatus, job->snapshot().error);
+                completeOnIoThread(ioContext, res, std::move(response), labels);
+            });
+            if (!queued) {
+                std::cerr << "[Jobs] Compute queue full, rejecting job " << job->id() << std::endl;
+                Metrics::instance().countJob(JobOutcome::Rejected);
+                jobStore.failJob(job, "Server busy");
+                res = crow::response(503, "Server busy, try again later");
+                res.set_header("Retry-After", "1");
+                res.end();
             }
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            res = crow::response(500, "Internal Server Error");
+            res.end();
+        }
+            });
 
-            // Parse JSON
-            auto json = crow::json::load(json_str);
-            if (!json) {
-                std::cerr << "Invalid JSON format" << std::endl;
-                return crow::response(400, "Invalid JSON format");
+    // Asynchronous variant of /api/upload: answers 202 with a job ID right away, the client then
+    // polls GET /api/jobs/<id> and fetches GET /api/jobs/<id>/result once the job is done.
+    CROW_ROUTE(app, "/api/jobs").methods(crow::HTTPMethod::Post).max_body_size(config.maxUploadBytes).stream_body(streamUpload)
+        ([&jobStore, &computePool, &progressHub, &resultCache](const crow::request& req) {
+        try {
+            auto upload = std::make_shared<UploadRequest>();
+            crow::response error;
+            if (!parseUploadRequest(req, *upload, error)) {
+                return error;
             }
 
-            // Extract enhancement options
-            bool sharpen = json["sharpen"].b();
-            bool denoise = json["denoise"].b();
-            bool colorCorrection = json["colorCorrection"].b();
-            bool superResolution = json["superResolution"].b();
-            bool beautify = json["beautify"].b();
-            std::string outputFormat = json.has("outputFormat") ? std::string(json["outputFormat"].s()) : "png";
-            int jpegQuality = (json.has("jpegQuality") && json["jpegQuality"].t() == crow::json::type::Number) ? json["jpegQuality"].i() : 95;
-
-            std::string outputPath = outputFormat == "png" ? "uploads/processed.png" : "uploads/processed.jpg";
-            enhanceImage(inputPath, outputPath, sharpen, denoise, colorCorrection, superResolution, beautify, outputFormat, jpegQuality);
+            std::shared_ptr<Job> job = jobStore.createJob(jobStages(upload->options));
+            persistUploadIfRequested(job->id(), *upload);
 
-            crow::json::wvalue responseBody;
-            responseBody["processedImageUrl"] = "/api/processed";
+            bool queued = true;
+            if (std::shared_ptr<const EncodedImage> cached = resultCache.findInMemory(upload->cacheKey)) {
+                completeFromCache(job, jobStore, progressHub, cached, true);
+            }
+            else {
+                // The job outlives this request; a buffered upload needs its own copy of the image.
+                upload->detachFromRequest();
+                queued = computePool.submit([&jobStore, &progressHub, &resultCache, job, upload]() {
+                    int errorStatus = 500;
+                    MetricLabels labels;
+                    runJob(job, jobStore, progressHub, resultCache, *upload, true, errorStatus, labels);
+                });
+            }
+            if (!queued) {
+                // The backlog is capped here instead of piling up in sockets.
+                std::cerr << "[Jobs] Compute queue full, rejecting job " << job->id() << std::endl;
+                Metrics::instance().countJob(JobOutcome::Rejected);
+                jobStore.failJob(job, "Server busy");
+                crow::response res(503, "Server busy, try again later");
+                res.set_header("Retry-After", "1");
+                return res;
+            }
+            if (job->state() == JobState::Queued) {
+                std::cout << "[Jobs] Job " << job->id() << " queued" << std::endl;
+            }
 
-            crow::response res(200, responseBody);
-            res.set_header("Access-Control-Allow-Origin", "*");  // ✅ Allow all origins
+            crow::response res(202, jobStatusJson(*job, computePool));
+            res.set_header("Location", "/api/jobs/" + job->id());
+            res.set_header("Access-Control-Allow-Origin", "*");
             res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
             res.set_header("Access-Control-Allow-Headers", "Content-Type");
-
+            res.set_header("Access-Control-Expose-Headers", "Location");
             return res;
         }
         catch (const std::exception& e) {
             std::cerr << "Exception: " << e.what() << std::endl;
             return crow::response(500, "Internal Server Error");
         }
-            });
+        });
 
-    CROW_ROUTE(app, "/api/processed").methods(crow::HTTPMethod::Get)
-        ([](const crow::request& req) {
+    // Many images with one set of options: any number of "files" parts plus an "options" part.
+    // The response is multipart/mixed with one part per image, sent with chunked encoding in the
+    // order the images finish, so the first result goes out while the rest are still processing.
+    CROW_ROUTE(app, "/api/batch").methods(crow::HTTPMethod::Post).max_body_size(config.maxBatchBytes).stream_body(streamBatch)
+        ([&jobStore, &computePool, &progressHub, &resultCache](const crow::request& req, crow::response& res) {
         try {
-            std::string format = req.url_params.get("format") ? req.url_params.get("format") : "png";
-            std::string filePath = format == "jpeg" ? "uploads/processed.jpg" : "uploads/processed.png";
-            if (!std::filesystem::exists(filePath)) {
-                return crow::response(404, "Processed image not found");
+            auto stream = std::dynamic_pointer_cast<MultipartUploadStream>(req.streamed_body);
+            if (!stream || !stream->hasFile()) {
+                std::cerr << "Missing 'files' fields" << std::endl;
+                res = crow::response(400, "Missing 'files' fields");
+                res.end();
+                return;
             }
-            std::ifstream file(filePath, std::ios::binary);
-            if (!file) {
-                return crow::response(500, "Failed to open processed image");
-            }
-            file.seekg(0, std::ios::end);
-            size_t fileSize = file.tellg();
-            file.seekg(0, std::ios::beg);
-            std::vector<char> buffer(fileSize);
-            file.read(buffer.data(), fileSize);
-            crow::response res;
-            res.body = std::string(buffer.data(), fileSize);
-            if (format == "jpeg") {
-                res.set_header("Content-Type", "image/jpeg");
-                res.set_header("Content-Disposition", "attachment; filename=enhanced_image.jpg");
-            } else {
-                res.set_header("Content-Type", "image/png");
-                res.set_header("Content-Disposition", "attachment; filename=enhanced_image.png");
+            UploadRequest settings;
+            if (!parseUploadOptions(stream->field("options"), settings, res)) {
+                res.end();
+                return;
             }
+
+            auto run = std::make_shared<BatchRun>();
+            run->stream = std::move(stream);
+            run->options = settings.options;
+            run->persistUpload = settings.persistUpload;
+            run->res = &res;
+            run->ioContext = req.io_context;
+            run->boundary = "batch-" + JobStore::createJobId();
+            run->maxRunning = std::max<std::size_t>(1, computePool.threadCount());
+            std::cout << "[Jobs] Batch of " << run->stream->fileCount() << " files" << std::endl;
+
+            res.code = 200;
+            res.set_header("Content-Type", "multipart/mixed; boundary=" + run->boundary);
+            res.set_header("X-Batch-Size", std::to_string(run->stream->fileCount()));
             res.set_header("Access-Control-Allow-Origin", "*");
-            res.set_header("Access-Control-Allow-Methods", "GET, OPTIONS");
-            res.set_header("Access-Control-Expose-Headers", "Content-Disposition");
+            res.set_header("Access-Control-Allow-Methods", "POST, OPTIONS");
+            res.set_header("Access-Control-Allow-Headers", "Content-Type");
+            res.set_header("Access-Control-Expose-Headers", "X-Batch-Size");
+            res.begin_chunked();
+            feedBatch(run, jobStore, progressHub, resultCache, computePool);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            // Once parts are being sent the batch ends itself as its files finish.
+            if (!res.is_chunked()) {
+                res = crow::response(500, "Internal Server Error");
+                res.end();
+            }
+        }
+        });
+
+    CROW_ROUTE(app, "/api/jobs/<string>").methods(crow::HTTPMethod::Get)
+        ([&jobStore, &computePool](const std::string& jobId) {
+        std::shared_ptr<Job> job = jobStore.findJob(jobId);
+        if (!job) {
+            return crow::response(404, "Job not found");
+        }
+        crow::response res(200, jobStatusJson(*job, computePool));
+        res.set_header("Cache-Control", "no-store");
+        res.set_header("Access-Control-Allow-Origin", "*");
+        return res;
+        });
+
+    CROW_ROUTE(app, "/api/jobs/<string>/result").methods(crow::HTTPMethod::Get)
+        ([&jobStore](const crow::request& req, const std::string& jobId) {
+        std::shared_ptr<Job> job = jobStore.findJob(jobId);
+        if (!job) {
+            return crow::response(404, "Job not found");
+        }
+        JobState state = job->state();
+        if (state == JobState::Failed) {
+            return crow::response(409, "Job failed: " + job->snapshot().error);
+        }
+        std::shared_ptr<const EncodedImage> result = job->result();
+        if (state != JobState::Done || !result) {
+            crow::response res(409, std::string("Job is ") + jobStateName(state));
+            res.set_header("Retry-After", "1");
             return res;
         }
+        return resultResponse(req, result);
+        });
+
+    // Live progress for one job: JSON status messages with stage start/finish events, plus JPEG
+    // preview frames as binary messages when the URL has ?preview=1. Closed after the final status.
+    CROW_WEBSOCKET_ROUTE(app, "/ws/jobs/<string>")
+        .onaccept([&jobStore](const crow::request& req, void** userdata) {
+            // WebSocket rules do not pass route parameters, so the job ID is taken from the URL.
+            const std::string prefix = "/ws/jobs/";
+            if (req.url.compare(0, prefix.size(), prefix) != 0) {
+                return false;
+            }
+            std::shared_ptr<Job> job = jobStore.findJob(req.url.substr(prefix.size()));
+            if (!job) {
+                return false;
+            }
+            *userdata = new WebSocketSubscriber{std::move(job), req.io_context, req.url_params.get("preview") != nullptr};
+            return true;
+        })
+        .onopen([&progressHub](crow::websocket::connection& conn) {
+            auto* subscriber = static_cast<WebSocketSubscriber*>(conn.userdata());
+            progressHub.subscribe(conn, subscriber->job, subscriber->ioContext, subscriber->wantsPreview);
+        })
+        .onmessage([](crow::websocket::connection&, const std::string&, bool) {
+            // Clients only listen.
+        })
+        .onclose([&progressHub](crow::websocket::connection& conn, const std::string&, uint16_t) {
+            progressHub.unsubscribe(conn);
+            delete static_cast<WebSocketSubscriber*>(conn.userdata());
+            conn.userdata(nullptr);
+        });
+
+    CROW_ROUTE(app, "/api/processed/<string>").methods(crow::HTTPMethod::Get)
+        ([&jobStore](const crow::request& req, const std::string& jobId) {
+        try {
+            std::shared_ptr<const EncodedImage> result = jobStore.getResult(jobId);
+            if (!result) {
+                return crow::response(404, "Processed image not found");
+            }
+            return resultResponse(req, result);
+        }
         catch (const std::exception& e) {
             std::cerr << "Exception serving processed file: " << e.what() << std::endl;
             return crow::response(500, "Internal Server Error");
         }
         });
-            
 
-    app.port(8080).multithreaded().run();
+
+    // Prometheus scrape target: job counters, per-stage latency histograms and the current queue and store sizes.
+    CROW_ROUTE(app, "/metrics").methods(crow::HTTPMethod::Get)
+        ([&jobStore, &computePool, &resultCache]() {
+        std::string text = Metrics::instance().renderPrometheus();
+        text += "# HELP photo_enhancer_queue_length Jobs waiting for a compute thread.\n";
+        text += "# TYPE photo_enhancer_queue_length gauge\n";
+        text += "photo_enhancer_queue_length " + std::to_string(computePool.queued()) + "\n";
+        text += "# HELP photo_enhancer_queue_capacity Jobs that may wait before uploads are rejected.\n";
+        text += "# TYPE photo_enhancer_queue_capacity gauge\n";
+        text += "photo_enhancer_queue_capacity " + std::to_string(computePool.maxQueued()) + "\n";
+        text += "# HELP photo_enhancer_stored_jobs Jobs held in the job store.\n";
+        text += "# TYPE photo_enhancer_stored_jobs gauge\n";
+        text += "photo_enhancer_stored_jobs " + std::to_string(jobStore.size()) + "\n";
+
+        CacheStats cache = resultCache.stats();
+        text += "# HELP photo_enhancer_cache_hits_total Jobs answered from the result cache.\n";
+        text += "# TYPE photo_enhancer_cache_hits_total counter\n";
+        text += "photo_enhancer_cache_hits_total{tier=\"memory\"} " + std::to_string(cache.memoryHits) + "\n";
+        text += "photo_enhancer_cache_hits_total{tier=\"disk\"} " + std::to_string(cache.diskHits) + "\n";
+        text += "# HELP photo_enhancer_cache_misses_total Jobs not found in the result cache.\n";
+        text += "# TYPE photo_enhancer_cache_misses_total counter\n";
+        text += "photo_enhancer_cache_misses_total " + std::to_string(cache.misses) + "\n";
+        text += "# HELP photo_enhancer_cache_evictions_total Results dropped from the result cache to stay within budget.\n";
+        text += "# TYPE photo_enhancer_cache_evictions_total counter\n";
+        text += "photo_enhancer_cache_evictions_total{tier=\"memory\"} " + std::to_string(cache.memoryEvictions) + "\n";
+        text += "photo_enhancer_cache_evictions_total{tier=\"disk\"} " + std::to_string(cache.diskEvictions) + "\n";
+        text += "# HELP photo_enhancer_cache_bytes Encoded result bytes held by the result cache.\n";
+        text += "# TYPE photo_enhancer_cache_bytes gauge\n";
+        text += "photo_enhancer_cache_bytes{tier=\"memory\"} " + std::to_string(cache.memoryBytes) + "\n";
+        text += "photo_enhancer_cache_bytes{tier=\"disk\"} " + std::to_string(cache.diskBytes) + "\n";
+        text += "# HELP photo_enhancer_cache_entries Results held by the result cache.\n";
+        text += "# TYPE photo_enhancer_cache_entries gauge\n";
+        text += "photo_enhancer_cache_entries{tier=\"memory\"} " + std::to_string(cache.memoryEntries) + "\n";
+        text += "photo_enhancer_cache_entries{tier=\"disk\"} " + std::to_string(cache.diskEntries) + "\n";
+
+        if (const MatPool* matPool = MatPool::installed()) {
+            MatPoolStats pool = matPool->stats();
+            text += "# HELP photo_enhancer_mat_pool_allocations_total Image buffer allocations of pooled size, by whether a retained buffer was reused.\n";
+            text += "# TYPE photo_enhancer_mat_pool_allocations_total counter\n";
+            text += "photo_enhancer_mat_pool_allocations_total{result=\"hit\"} " + std::to_string(pool.hits) + "\n";
+            text += "photo_enhancer_mat_pool_allocations_total{result=\"miss\"} " + std::to_string(pool.misses) + "\n";
+            text += "# HELP photo_enhancer_mat_pool_releases_total Freed image buffers returned to the system because the pool was full.\n";
+            text += "# TYPE photo_enhancer_mat_pool_releases_total counter\n";
+            text += "photo_enhancer_mat_pool_releases_total " + std::to_string(pool.releases) + "\n";
+            text += "# HELP photo_enhancer_mat_pool_bytes Image buffer bytes held by the pool, free (retained) or owned by images (in_use).\n";
+            text += "# TYPE photo_enhancer_mat_pool_bytes gauge\n";
+            text += "photo_enhancer_mat_pool_bytes{state=\"retained\"} " + std::to_string(pool.retainedBytes) + "\n";
+            text += "photo_enhancer_mat_pool_bytes{state=\"in_use\"} " + std::to_string(pool.inUseBytes) + "\n";
+        }
+
+        crow::response res(200, text);
+        res.set_header("Content-Type", "text/plain; version=0.0.4");
+        return res;
+        });
+
+    // IO and compute threads are sized independently; see ServerConfig.
+    std::cout << "[Server] Listening on port " << config.port << " with " << config.ioThreads << " IO threads" << std::endl;
+    app.port(config.port).concurrency(static_cast<std::uint16_t>(config.ioThreads)).run();
 }
 
@@ -3,8 +3,76 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct PipelinePlan;
+
+// Options for one enhancement run, as sent by the client in the "options" field.
+struct EnhanceOptions {
+    bool sharpen = false;
+    bool denoise = false;
+    bool colorCorrection = false;
+    bool superResolution = false;
+    bool beautify = false;
+    std::string denoiseMode = "nlm";            // "nlm" (non-local means) or "fast" (guided filter)
+    std::string superResolutionModel = "espcn"; // "espcn", "fsrcnn" or "bicubic"
+    int superResolutionScale = 2;               // 2, 3 or 4
+    double claheClipLimit = 2.0;                // Colour correction contrast limit, 0 for plain equalization
+    cv::Size claheTileGrid = cv::Size(8, 8);    // Colour correction tiles across and down
+    std::string faceDetector;                   // Beautify's "haar" or "yunet"; empty for the deployment default
+    std::string outputFormat = "png"; // "png" or "jpeg"
+    int jpegQuality = 95;
+    int deadlineMs = 0;                         // Latency budget from startedAt through encode; 0 for none
+    // When the request's clock started (the server uses the job's creation time); unset means
+    // when planning starts.
+    std::chrono::steady_clock::time_point startedAt{};
+};
+
+// An encoded result image, ready to be moved into an HTTP response body.
+struct EncodedImage {
+    std::string bytes;       // Encoded file contents (empty on failure)
+    std::string contentType; // "image/png" or "image/jpeg"
+    std::string extension;   // "png" or "jpg"
+    std::string etag;        // Quoted HTTP entity tag, when the server assigned one
+};
+
+// Decodes an encoded image (JPEG, PNG, ...) straight from memory. Returns an empty Mat on failure.
+cv::Mat decodeImage(const char* data, std::size_t size);
+// Decodes an image file with cv::imread, which reads it incrementally rather than into one buffer.
+// Used for uploads spilled to disk. Returns an empty Mat on failure.
+cv::Mat decodeImageFile(const std::string& path);
+
+// Receives pipeline progress: 0 when a stage starts, 1 when it finishes, and the fraction of
+// tiles done in between for tiled stages (possibly from OpenCV worker threads).
+using ProgressCallback = std::function<void(const std::string& stage, double progress)>;
+
+// Receives the working image right after a stage finishes, e.g. to render a preview.
+using StageImageCallback = std::function<void(const std::string& stage, const cv::Mat& image)>;
+
+// Names of the enhancement stages applyEnhancements runs for these options, in the order the planner runs them.
+std::vector<std::string> pipelineStages(const EnhanceOptions& options);
+
+// Runs the selected enhancement steps on a copy of the image and returns it. The step order and
+// working resolutions come from planPipeline (Pipeline_Planner.h); the plan it picked is stored
+// in chosenPlan when one is given.
+cv::Mat applyEnhancements(const cv::Mat& image, const EnhanceOptions& options, const ProgressCallback& progress = nullptr, PipelinePlan* chosenPlan = nullptr, const StageImageCallback& stageImage = nullptr);
+// Same, but works on `image` itself instead of a copy, for callers that are done with the input;
+// this saves a full-size copy. Images of at least TiledExecutionSettings::minMegapixels run each
+// stage strip by strip (Tiled_Execution.h), so the peak is about the input and output images plus
+// a few strips rather than several full-size temporaries.
+cv::Mat applyEnhancements(cv::Mat&& image, const EnhanceOptions& options, const ProgressCallback& progress = nullptr, PipelinePlan* chosenPlan = nullptr, const StageImageCallback& stageImage = nullptr);
+
+// Encodes to PNG or JPEG in memory with cv::imencode. Returns an empty EncodedImage on failure.
+EncodedImage encodeImage(const cv::Mat& image, const std::string& outputFormat, int jpegQuality);
 
 void enhanceImage(const std::string& inputPath, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality);
+// In-memory variants: the upload bytes are decoded with cv::imdecode, nothing is read from disk.
+void enhanceImage(const char* data, std::size_t size, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality);
+void enhanceImage(const cv::Mat& image, const std::string& outputPath, bool sharpen, bool denoise, bool colorCorrection, bool superResolution, bool beautify, const std::string& outputFormat, int jpegQuality);
 
 // TODO: Reference additional headers your program requires here.
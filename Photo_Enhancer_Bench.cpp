@@ -0,0 +1,514 @@
+﻿// Photo_Enhancer_Bench.cpp : Times every pipeline stage on synthetic images and writes JSON.
+//
+// Usage: photo_enhancer_bench [--sizes 0.3,1,3,12,24,48] [--repeats 3] [--combos all|0,5,31]
+//                             [--format png|jpeg] [--sr-model espcn|fsrcnn|bicubic] [--denoise-modes nlm,fast]
+//                             [--face-detectors haar,yunet] [--out file.json] [--verbose]
+//
+// Every combination of the five enhancement flags (sharpen=1, denoise=2, colorCorrection=4,
+// superResolution=8, beautify=16) runs on a deterministic synthetic photo of each size; the
+// combinations with denoise run once per denoise mode and those with beautify once per face
+// detector. Denoise-only cases also report the PSNR of input and output against the photo
+// before noise was added. Models are loaded from the same environment variables as the server. The full sweep up to 48 MP
+// takes hours on a laptop; narrow it with --sizes and --combos for quick checks.
+//
+// Before the sweep, each stage that replaces a plain OpenCV call with a tiled or fused version is
+// compared with that call on one photo, and the bench fails if they differ by more than the
+// stage's header promises.
+
+#include "Photo_Enhancer.h"
+#include "Color_Correction.h"
+#include "Face_Detection.h"
+#include "Guided_Filter.h"
+#include "Mat_Pool.h"
+#include "Model_Registry.h"
+#include "Pipeline_Planner.h"
+#include "Server_Config.h"
+#include "Super_Resolution.h"
+#include "Tiled_Denoise.h"
+#include "Tiled_Execution.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/photo.hpp>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using BenchClock = std::chrono::steady_clock;
+
+static const char* const FlagNames[] = {"sharpen", "denoise", "colorCorrection", "superResolution", "beautify"};
+static const char* const StageOrder[] = {"decode", "sharpen", "denoise", "colorCorrection", "superResolution", "beautify", "encode", "total"};
+
+struct BenchSettings {
+    std::vector<double> megapixels = {0.3, 1, 3, 12, 24, 48};
+    std::vector<int> combos;  // Flag masks; empty means all 32
+    int repeats = 3;
+    std::string outputFormat = "png";
+    std::string superResolutionModel = "espcn";
+    std::vector<std::string> denoiseModes = {"nlm", "fast"};
+    std::vector<std::string> faceDetectors; // Empty means every loaded backend
+    std::string outputPath = "photo_enhancer_bench.json";
+    bool verbose = false;
+};
+
+// Swallows the pipeline's per-stage logging so it does not drown the bench output.
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+// Process-wide peak resident set size so far, in bytes.
+static std::size_t peakRssBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (std::size_t)usage.ru_maxrss;
+#else
+    return (std::size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// A deterministic stand-in for a photo: smooth gradients, hard-edged shapes and sensor-like
+// noise, so sharpen, denoise and CLAHE all have real work to do. `clean` receives the photo
+// before the noise.
+static cv::Mat syntheticImage(cv::Size size, std::uint64_t seed, cv::Mat* clean = nullptr) {
+    cv::Mat image(size, CV_8UC3);
+    for (int y = 0; y < size.height; ++y) {
+        cv::Vec3b* row = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < size.width; ++x) {
+            row[x] = cv::Vec3b(
+                (uchar)(255 * x / size.width),
+                (uchar)(255 * y / size.height),
+                (uchar)(128 + 100 * std::sin((x + y) * 0.005)));
+        }
+    }
+
+    cv::RNG rng(seed);
+    int shapes = std::max(20, (int)(size.area() / 50'000));
+    for (int i = 0; i < shapes; ++i) {
+        cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        int radius = rng.uniform(4, std::max(5, size.width / 20));
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        if (i % 2 == 0) {
+            cv::circle(image, center, radius, color, cv::FILLED, cv::LINE_AA);
+        } else {
+            cv::rectangle(image, cv::Rect(center.x, center.y, radius * 2, radius), color, cv::FILLED);
+        }
+    }
+
+    if (clean) {
+        *clean = image.clone();
+    }
+    cv::Mat noise(size, CV_16SC3);
+    rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(6));
+    cv::add(image, noise, image, cv::noArray(), CV_8UC3);
+    return image;
+}
+
+static double elapsedMs(BenchClock::time_point start, BenchClock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Nearest-rank percentile of a non-empty sample.
+static double percentile(std::vector<double> samples, double fraction) {
+    std::sort(samples.begin(), samples.end());
+    std::size_t rank = (std::size_t)std::ceil(fraction * samples.size());
+    return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+}
+
+// One timed decode > enhance > encode run. Stage times come from the progress callback: a stage
+// runs from its first report to its last report of 1. `output` receives the enhanced image.
+static std::map<std::string, double> runOnce(const std::string& encodedInput, const EnhanceOptions& options, std::string& plan, cv::Mat* output = nullptr) {
+    // Stages start at 0.0 and end at 1.0, reported on this thread between steps. Tile progress in
+    // between comes from OpenCV's worker threads, and the last tile's 1.0 can come before the
+    // stage's final step, so tile fractions are ignored and the latest 1.0 is the stage's end.
+    std::mutex stagesMutex;
+    std::map<std::string, BenchClock::time_point> started;
+    std::map<std::string, BenchClock::time_point> finished;
+    auto onProgress = [&](const std::string& stage, double progress) {
+        if (progress > 0.0 && progress < 1.0) {
+            return;
+        }
+        BenchClock::time_point now = BenchClock::now();
+        std::lock_guard<std::mutex> lock(stagesMutex);
+        started.emplace(stage, now);
+        if (progress >= 1.0) {
+            finished[stage] = std::max(finished[stage], now);
+        }
+    };
+
+    std::map<std::string, double> timings;
+    BenchClock::time_point begin = BenchClock::now();
+    cv::Mat image = decodeImage(encodedInput.data(), encodedInput.size());
+    BenchClock::time_point decoded = BenchClock::now();
+    timings["decode"] = elapsedMs(begin, decoded);
+
+    PipelinePlan chosen;
+    cv::Mat enhanced = applyEnhancements(std::move(image), options, onProgress, &chosen);
+    BenchClock::time_point enhancedAt = BenchClock::now();
+    for (const auto& [stage, start] : started) {
+        auto end = finished.find(stage);
+        timings[stage] = elapsedMs(start, end != finished.end() ? end->second : enhancedAt);
+    }
+    plan = chosen.describe();
+
+    EncodedImage encoded = encodeImage(enhanced, options.outputFormat, options.jpegQuality);
+    BenchClock::time_point end = BenchClock::now();
+    if (output) {
+        *output = enhanced;
+    }
+    timings["encode"] = elapsedMs(enhancedAt, end);
+    timings["total"] = elapsedMs(begin, end);
+    if (encoded.bytes.empty()) {
+        throw std::runtime_error("encode failed");
+    }
+    return timings;
+}
+
+// How far a stage's output is from the plain OpenCV call it replaces, in 8-bit levels per channel.
+struct EquivalenceCheck {
+    std::string name;
+    double maxAbsDiff = 0.0;
+    double meanAbsDiff = 0.0;
+    double tolerance = 0.0;  // Largest difference the stage's header allows
+
+    bool passed() const { return maxAbsDiff <= tolerance; }
+};
+
+static EquivalenceCheck compareImages(const std::string& name, const cv::Mat& actual, const cv::Mat& expected, double tolerance) {
+    cv::Mat diff;
+    cv::absdiff(actual, expected, diff);
+    EquivalenceCheck check;
+    check.name = name;
+    cv::minMaxLoc(diff.reshape(1), nullptr, &check.maxAbsDiff);
+    cv::Scalar channelMeans = cv::mean(diff);
+    for (int c = 0; c < diff.channels(); ++c) {
+        check.meanAbsDiff += channelMeans[c] / diff.channels();
+    }
+    check.tolerance = tolerance;
+    return check;
+}
+
+// Runs the tiled and fused stages next to their references on a photo that spans several tiles
+// and strips, with partial ones at the right and bottom edges.
+static std::vector<EquivalenceCheck> runEquivalenceChecks() {
+    const cv::Mat image = syntheticImage(cv::Size(1000, 750), 7);
+    std::vector<EquivalenceCheck> checks;
+
+    NlmParameters nlm;
+    cv::Mat nlmReference;
+    cv::fastNlMeansDenoisingColored(image, nlmReference, nlm.h, nlm.hColor, nlm.templateWindow, nlm.searchWindow);
+    checks.push_back(compareImages("denoiseTiled", denoiseTiled(image, nlm, 256), nlmReference, 0.0));
+
+    ClaheParameters clahe;
+    std::vector<cv::Mat> lab;
+    cv::Mat claheReference;
+    cv::cvtColor(image, claheReference, cv::COLOR_BGR2Lab);
+    cv::split(claheReference, lab);
+    cv::createCLAHE(clahe.clipLimit, clahe.tileGrid)->apply(lab[0], lab[0]);
+    cv::merge(lab, claheReference);
+    cv::cvtColor(claheReference, claheReference, cv::COLOR_Lab2BGR);
+    cv::Mat equalized = image.clone();
+    equalizeLightness(equalized, clahe);
+    checks.push_back(compareImages("equalizeLightness", equalized, claheReference, 2.0));
+
+    GuidedDenoiseParameters guided;
+    cv::Mat guidedReference;
+    image.convertTo(guidedReference, CV_32F, 1.0 / 255.0);
+    guidedFilter(guidedReference, guided.radius, guided.eps).convertTo(guidedReference, CV_8U, 255.0);
+    checks.push_back(compareImages("denoiseGuided", denoiseGuided(image, guided), guidedReference, 1.0));
+    return checks;
+}
+
+static std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// PSNR in dB against the noise-free photo, for denoise-only cases.
+struct DenoiseQuality {
+    double inputPsnr = 0.0;
+    double outputPsnr = 0.0;
+};
+
+static std::string caseJson(double megapixels, cv::Size size, int mask, const EnhanceOptions& options, const std::string& plan,
+                            const std::map<std::string, std::vector<double>>& samples, const DenoiseQuality* quality) {
+    double actualMegapixels = size.area() / 1e6;
+    std::ostringstream json;
+    json << "    {\"megapixels\": " << megapixels << ", \"width\": " << size.width << ", \"height\": " << size.height
+         << ", \"mask\": " << mask << ", \"options\": {";
+    for (int flag = 0; flag < 5; ++flag) {
+        json << (flag ? ", " : "") << "\"" << FlagNames[flag] << "\": " << ((mask >> flag) & 1 ? "true" : "false");
+    }
+    if (options.denoise) {
+        json << ", \"denoiseMode\": \"" << options.denoiseMode << "\"";
+    }
+    if (options.beautify) {
+        json << ", \"faceDetector\": \"" << options.faceDetector << "\"";
+    }
+    json << "}";
+    if (quality) {
+        json << ", \"psnr\": {\"input\": " << quality->inputPsnr << ", \"output\": " << quality->outputPsnr << "}";
+    }
+    json << ", \"plan\": \"" << jsonEscape(plan) << "\", \"stages\": {";
+    bool first = true;
+    for (const char* stage : StageOrder) {
+        auto it = samples.find(stage);
+        if (it == samples.end()) {
+            continue;
+        }
+        double median = percentile(it->second, 0.5);
+        json << (first ? "" : ", ") << "\"" << stage << "\": {\"medianMs\": " << median
+             << ", \"p95Ms\": " << percentile(it->second, 0.95)
+             << ", \"megapixelsPerSecond\": " << (median > 0 ? actualMegapixels / (median / 1000.0) : 0.0) << "}";
+        first = false;
+    }
+    json << "}, \"peakRssBytes\": " << peakRssBytes() << "}";
+    return json.str();
+}
+
+// Rewrites the whole report, so a long sweep leaves usable results behind if it is interrupted.
+static void writeReport(const BenchSettings& settings, const std::vector<EquivalenceCheck>& checks, const std::vector<std::string>& cases) {
+    std::ofstream out(settings.outputPath);
+    out << "{\n  \"opencvVersion\": \"" << cv::getVersionString() << "\", \"threads\": " << cv::getNumThreads()
+        << ", \"repeats\": " << settings.repeats << ", \"outputFormat\": \"" << settings.outputFormat
+        << "\", \"superResolutionModel\": \"" << settings.superResolutionModel << "\",\n";
+    if (const MatPool* matPool = MatPool::installed()) {
+        MatPoolStats pool = matPool->stats();
+        out << "  \"matPool\": {\"hits\": " << pool.hits << ", \"misses\": " << pool.misses << ", \"hitRate\": " << pool.hitRate()
+            << ", \"releases\": " << pool.releases << ", \"retainedBytes\": " << pool.retainedBytes << "},\n";
+    }
+    out << "  \"checks\": [";
+    for (std::size_t i = 0; i < checks.size(); ++i) {
+        const EquivalenceCheck& check = checks[i];
+        out << (i ? ", " : "") << "{\"name\": \"" << check.name << "\", \"maxAbsDiff\": " << check.maxAbsDiff
+            << ", \"meanAbsDiff\": " << check.meanAbsDiff << ", \"tolerance\": " << check.tolerance
+            << ", \"passed\": " << (check.passed() ? "true" : "false") << "}";
+    }
+    out << "],\n";
+    out << "  \"cases\": [\n";
+    for (std::size_t i = 0; i < cases.size(); ++i) {
+        out << cases[i] << (i + 1 < cases.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static bool parseArguments(int argc, char** argv, BenchSettings& settings) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--verbose") {
+            settings.verbose = true;
+        } else if (arg == "--sizes" && hasValue) {
+            settings.megapixels.clear();
+            for (const std::string& item : splitList(argv[++i])) {
+                settings.megapixels.push_back(std::stod(item));
+            }
+        } else if (arg == "--repeats" && hasValue) {
+            settings.repeats = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--combos" && hasValue) {
+            std::string value = argv[++i];
+            settings.combos.clear();
+            if (value != "all") {
+                for (const std::string& item : splitList(value)) {
+                    settings.combos.push_back(std::stoi(item) & 31);
+                }
+            }
+        } else if (arg == "--format" && hasValue) {
+            settings.outputFormat = argv[++i];
+        } else if (arg == "--sr-model" && hasValue) {
+            settings.superResolutionModel = argv[++i];
+        } else if (arg == "--denoise-modes" && hasValue) {
+            settings.denoiseModes = splitList(argv[++i]);
+        } else if (arg == "--face-detectors" && hasValue) {
+            settings.faceDetectors = splitList(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            settings.outputPath = argv[++i];
+        } else {
+            std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (settings.combos.empty()) {
+        for (int mask = 0; mask < 32; ++mask) {
+            settings.combos.push_back(mask);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchSettings settings;
+    try {
+        if (!parseArguments(argc, argv, settings)) {
+            return 2;
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "Invalid number in arguments" << std::endl;
+        return 2;
+    }
+
+    ServerConfig config = ServerConfig::fromEnvironment();
+    MatPool::install(config.matPoolSettings());
+    configureSuperResolution(config.superResolutionSettings());
+    configureTiledExecution(config.tiledExecutionSettings());
+    configureFaceDetection(config.faceDetectionSettings());
+    try {
+        ModelRegistry::instance().registerCascade(ModelRegistry::FaceCascade, config.faceCascadePath);
+        registerSuperResolutionNetworks(config.superResolutionModelDir);
+        registerYuNetFaceDetector(config.faceYuNetModelPath);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "[Models] " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (settings.faceDetectors.empty()) {
+        for (const char* detector : {"haar", "yunet"}) {
+            if (faceDetector(detector)) {
+                settings.faceDetectors.push_back(detector);
+            }
+        }
+    }
+    for (const std::string& detector : settings.faceDetectors) {
+        if (!faceDetector(detector)) {
+            std::cerr << "Face detector not available: " << detector << std::endl;
+            return 2;
+        }
+    }
+    for (const std::string& mode : settings.denoiseModes) {
+        if (mode != "nlm" && mode != "fast") {
+            std::cerr << "Unknown denoise mode: " << mode << std::endl;
+            return 2;
+        }
+    }
+
+    NullBuffer nullBuffer;
+    std::streambuf* consoleBuffer = std::cout.rdbuf();
+    if (!settings.verbose) {
+        std::cout.rdbuf(&nullBuffer);
+    }
+
+    // Builds this thread's model instances before anything is timed.
+    EnhanceOptions warmup;
+    warmup.sharpen = warmup.denoise = warmup.colorCorrection = warmup.superResolution = warmup.beautify = true;
+    warmup.superResolutionModel = settings.superResolutionModel;
+    for (const std::string& detector : settings.faceDetectors) {
+        warmup.faceDetector = detector;
+        applyEnhancements(syntheticImage(cv::Size(320, 240), 1), warmup);
+    }
+
+    std::vector<std::string> cases;
+    int status = 0;
+    const std::vector<EquivalenceCheck> checks = runEquivalenceChecks();
+    for (const EquivalenceCheck& check : checks) {
+        std::cerr << "[Bench] Check " << check.name << ": max diff " << check.maxAbsDiff << ", mean " << check.meanAbsDiff
+                  << " (tolerance " << check.tolerance << ")" << (check.passed() ? "" : " FAILED") << std::endl;
+        if (!check.passed()) {
+            status = 1;
+        }
+    }
+    writeReport(settings, checks, cases);
+    for (double megapixels : settings.megapixels) {
+        int width = (int)std::lround(std::sqrt(megapixels * 1e6 * 4.0 / 3.0));
+        cv::Size size(width, (int)std::lround(width * 3.0 / 4.0));
+        cv::Mat clean;
+        std::vector<uchar> buffer;
+        cv::imencode(".jpg", syntheticImage(size, 42, &clean), buffer, {cv::IMWRITE_JPEG_QUALITY, 95});
+        std::string encodedInput(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        const double inputPsnr = cv::PSNR(decodeImage(encodedInput.data(), encodedInput.size()), clean);
+
+        for (int mask : settings.combos) {
+            // Modes and detectors only matter with their stage; the other combinations run once.
+            std::vector<std::string> modes = mask & 2 ? settings.denoiseModes : std::vector<std::string>{"nlm"};
+            std::vector<std::string> detectors = mask & 16 ? settings.faceDetectors : std::vector<std::string>{""};
+            for (const std::string& mode : modes) {
+                for (const std::string& detector : detectors) {
+                    EnhanceOptions options;
+                    options.sharpen = mask & 1;
+                    options.denoise = mask & 2;
+                    options.colorCorrection = mask & 4;
+                    options.superResolution = mask & 8;
+                    options.beautify = mask & 16;
+                    options.denoiseMode = mode;
+                    options.superResolutionModel = settings.superResolutionModel;
+                    options.faceDetector = detector;
+                    options.outputFormat = settings.outputFormat;
+                    std::ostringstream label;
+                    label << megapixels << " MP, mask " << mask << (mask & 2 ? " (" + mode + ")" : "")
+                          << (detector.empty() ? "" : " (" + detector + ")");
+
+                    std::map<std::string, std::vector<double>> samples;
+                    std::string plan;
+                    cv::Mat output;
+                    try {
+                        for (int run = 0; run < settings.repeats; ++run) {
+                            for (const auto& [stage, ms] : runOnce(encodedInput, options, plan, &output)) {
+                                samples[stage].push_back(ms);
+                            }
+                        }
+                    }
+                    catch (const std::exception& e) {
+                        std::cerr << "[Bench] " << label.str() << " failed: " << e.what() << std::endl;
+                        status = 1;
+                        continue;
+                    }
+                    // Only with denoise alone is the output meant to approach the clean photo.
+                    DenoiseQuality quality{inputPsnr, mask == 2 ? cv::PSNR(output, clean) : 0.0};
+                    cases.push_back(caseJson(megapixels, size, mask, options, plan, samples, mask == 2 ? &quality : nullptr));
+                    writeReport(settings, checks, cases);
+                    std::cerr << "[Bench] " << label.str() << ": total median " << percentile(samples["total"], 0.5) << " ms";
+                    if (mask == 2) {
+                        std::cerr << ", PSNR " << quality.inputPsnr << " -> " << quality.outputPsnr << " dB";
+                    }
+                    std::cerr << std::endl;
+                }
+            }
+        }
+    }
+
+    std::cout.rdbuf(consoleBuffer);
+    std::cout << "Wrote " << cases.size() << " cases to " << settings.outputPath << std::endl;
+    return status;
+}
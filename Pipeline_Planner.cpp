@@ -0,0 +1,281 @@
+﻿#include "Pipeline_Planner.h"
+#include "Face_Detection.h"
+#include "Latency_Model.h"
+#include "Super_Resolution.h"
+#include <algorithm>
+#include <sstream>
+#include <opencv2/imgproc.hpp>
+
+// Relative cost per megapixel of each step, measured against a Gaussian sharpen pass.
+// Rough numbers from profiling the stages on 12 MP photos; only their ratios matter.
+static double stepWeight(const PlannedStep& step) {
+    switch (step.kind) {
+    case StepKind::Sharpen: return 1.0;
+    case StepKind::Resample: return 0.4;
+    case StepKind::Denoise: return step.network == "fast" ? 3.0 : 40.0;
+    case StepKind::ColorCorrection: return 1.5;
+    case StepKind::DetectFaces: return 3.0;
+    case StepKind::SmoothFaces: return 2.0;
+    case StepKind::SuperResolve: return 50.0; // Per megapixel of network input
+    }
+    return 1.0;
+}
+
+static const char* stepName(StepKind kind) {
+    switch (kind) {
+    case StepKind::Sharpen: return "sharpen";
+    case StepKind::Resample: return "resample";
+    case StepKind::Denoise: return "denoise";
+    case StepKind::ColorCorrection: return "colorCorrection";
+    case StepKind::DetectFaces: return "detectFaces";
+    case StepKind::SmoothFaces: return "smoothFaces";
+    case StepKind::SuperResolve: return "superResolve";
+    }
+    return "unknown";
+}
+
+// Fills in the megapixels each step processes: a resample is charged for the larger of its input
+// and output, a network upscale for its input, face detection for its proxy.
+static void measureSteps(std::vector<PlannedStep>& steps, cv::Size inputSize) {
+    double inputMegapixels = (double)inputSize.width * inputSize.height / 1e6;
+    double scale = 1.0;
+    for (PlannedStep& step : steps) {
+        double workScale = step.kind == StepKind::Resample ? std::max(scale, step.scale)
+                         : step.kind == StepKind::SuperResolve ? scale
+                         : step.scale;
+        step.megapixels = step.kind == StepKind::DetectFaces ? detectionProxyMegapixels(inputSize, step.scale, step.maxSide)
+                        : inputMegapixels * workScale * workScale;
+        scale = step.scale;
+    }
+}
+
+// Megapixels processed by a plan, weighted by step kind.
+static double estimateCost(const std::vector<PlannedStep>& steps) {
+    double cost = 0.0;
+    for (const PlannedStep& step : steps) {
+        cost += stepWeight(step) * step.megapixels;
+    }
+    return cost;
+}
+
+// Seconds the latency model expects the steps to take.
+static double predictSeconds(const std::vector<PlannedStep>& steps, cv::Size inputSize) {
+    double inputMegapixels = (double)inputSize.width * inputSize.height / 1e6;
+    double seconds = 0.0;
+    for (const PlannedStep& step : steps) {
+        seconds += LatencyModel::instance().predict(stepVariant(step), step.megapixels, inputMegapixels, stepWeight(step));
+    }
+    return seconds;
+}
+
+// The step that takes the full-resolution image to the chosen output scale.
+static PlannedStep superResolutionStep(const SuperResolutionChoice& choice) {
+    if (choice.network.empty()) {
+        return {StepKind::Resample, "superResolution", (double)choice.scale, cv::INTER_CUBIC};
+    }
+    return {StepKind::SuperResolve, "superResolution", (double)choice.scale, 0, choice.network};
+}
+
+static PipelinePlan finishPlan(std::vector<PlannedStep> steps, cv::Size inputSize, double outputScale) {
+    PipelinePlan plan;
+    plan.inputSize = inputSize;
+    plan.outputSize = cv::Size(cvRound(inputSize.width * outputScale), cvRound(inputSize.height * outputScale));
+    measureSteps(steps, inputSize);
+    plan.estimatedCost = estimateCost(steps);
+    plan.resampleCount = (int)std::count_if(steps.begin(), steps.end(), [](const PlannedStep& step) {
+        return step.kind == StepKind::Resample;
+    });
+    plan.steps = std::move(steps);
+    return plan;
+}
+
+// Everything runs at the input resolution; the upscale comes last.
+static std::vector<PlannedStep> planSteps(const EnhanceOptions& options, const SuperResolutionChoice& superRes, const std::string& faceDetector) {
+    std::vector<PlannedStep> steps;
+    if (options.sharpen) {
+        steps.push_back({StepKind::Sharpen, "sharpen", 1.0});
+    }
+    if (options.denoise) {
+        steps.push_back({StepKind::Denoise, "denoise", 1.0, 0, options.denoiseMode});
+    }
+    if (options.colorCorrection) {
+        steps.push_back({StepKind::ColorCorrection, "colorCorrection", 1.0});
+    }
+    if (options.beautify) {
+        steps.push_back({StepKind::DetectFaces, "beautify", 1.0, 0, faceDetector, 0.0, faceDetectionSettings().maxProxySide});
+        steps.push_back({StepKind::SmoothFaces, "beautify", 1.0});
+    }
+    if (options.superResolution && superRes.scale > 1) {
+        steps.push_back(superResolutionStep(superRes));
+    }
+    return steps;
+}
+
+// Swaps `step` for its next cheaper variant and describes the swap. Returns false if it has none.
+static bool cheapenStep(PlannedStep& step, std::string& description) {
+    switch (step.kind) {
+    case StepKind::Denoise:
+        if (step.network == "fast") {
+            return false;
+        }
+        description = "denoise nlm -> fast";
+        step.network = "fast";
+        return true;
+    case StepKind::SuperResolve:
+        description = "superResolution " + step.network + " -> bicubic";
+        step = {StepKind::Resample, step.stage, step.scale, cv::INTER_CUBIC};
+        return true;
+    case StepKind::DetectFaces: {
+        int side = step.maxSide / 2;
+        if (side < 256) {
+            return false;
+        }
+        description = "face detection proxy " + std::to_string(step.maxSide) + " -> " + std::to_string(side) + " px";
+        step.maxSide = side;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Greedily swaps step variants for cheaper ones until the plan is predicted to fit the deadline
+// or nothing cheaper is left.
+static void fitDeadline(PipelinePlan& plan, const EnhanceOptions& options) {
+    auto startedAt = options.startedAt == std::chrono::steady_clock::time_point{} ? std::chrono::steady_clock::now() : options.startedAt;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+    double inputMegapixels = (double)plan.inputSize.width * plan.inputSize.height / 1e6;
+    double outputMegapixels = (double)plan.outputSize.width * plan.outputSize.height / 1e6;
+    double encode = LatencyModel::instance().predict(encodeVariant(options.outputFormat), outputMegapixels, inputMegapixels,
+                                                     options.outputFormat == "png" ? 3.0 : 1.0);
+    plan.deadlineSeconds = std::max(options.deadlineMs / 1000.0 - elapsed - encode, 0.0);
+
+    while (plan.predictedSeconds > plan.deadlineSeconds) {
+        std::size_t best = plan.steps.size();
+        PlannedStep bestStep{};
+        std::string bestDescription;
+        double bestSeconds = plan.predictedSeconds;
+        for (std::size_t i = 0; i < plan.steps.size(); ++i) {
+            std::vector<PlannedStep> candidate = plan.steps;
+            std::string description;
+            if (!cheapenStep(candidate[i], description)) {
+                continue;
+            }
+            measureSteps(candidate, plan.inputSize);
+            double seconds = predictSeconds(candidate, plan.inputSize);
+            if (seconds < bestSeconds) {
+                best = i;
+                bestStep = candidate[i];
+                bestDescription = description;
+                bestSeconds = seconds;
+            }
+        }
+        if (best == plan.steps.size()) {
+            break;
+        }
+        plan.steps[best] = bestStep;
+        measureSteps(plan.steps, plan.inputSize);
+        plan.predictedSeconds = bestSeconds;
+        plan.downgrades.push_back(bestDescription);
+        plan.notes.push_back("deadline: " + bestDescription);
+    }
+    plan.estimatedCost = estimateCost(plan.steps);
+    plan.resampleCount = (int)std::count_if(plan.steps.begin(), plan.steps.end(), [](const PlannedStep& step) {
+        return step.kind == StepKind::Resample;
+    });
+    if (plan.predictedSeconds > plan.deadlineSeconds) {
+        plan.notes.push_back("deadline: predicted to be missed even with the cheapest variants");
+    }
+}
+
+PipelinePlan planPipeline(const EnhanceOptions& options, cv::Size inputSize) {
+    SuperResolutionChoice superRes;
+    if (options.superResolution) {
+        superRes = chooseSuperResolution(options.superResolutionModel, options.superResolutionScale, inputSize);
+    }
+    FaceDetectorChoice faceDetector;
+    if (options.beautify) {
+        faceDetector = chooseFaceDetector(options.faceDetector);
+    }
+    double outputScale = options.superResolution ? superRes.scale : 1.0;
+
+    PipelinePlan plan = finishPlan(planSteps(options, superRes, faceDetector.name), inputSize, outputScale);
+    if (options.superResolution && superRes.scale == 1) {
+        plan.skippedStages.push_back("superResolution");
+    }
+    if (!superRes.note.empty()) {
+        plan.notes.push_back(superRes.note);
+    }
+    if (!faceDetector.note.empty()) {
+        plan.notes.push_back(faceDetector.note);
+    }
+    plan.predictedSeconds = predictSeconds(plan.steps, inputSize);
+    if (options.deadlineMs > 0) {
+        fitDeadline(plan, options);
+    }
+    return plan;
+}
+
+std::vector<std::string> PipelinePlan::stageOrder() const {
+    std::vector<std::string> stages;
+    for (const PlannedStep& step : steps) {
+        if (std::find(stages.begin(), stages.end(), step.stage) == stages.end()) {
+            stages.push_back(step.stage);
+        }
+    }
+    return stages;
+}
+
+double PipelinePlan::stageSeconds(const std::string& stage) const {
+    double seconds = 0.0;
+    for (const PlannedStep& step : steps) {
+        if (step.stage == stage) {
+            seconds += step.seconds;
+        }
+    }
+    return seconds;
+}
+
+std::string PipelinePlan::describe() const {
+    std::ostringstream text;
+    for (std::size_t i = 0; i < steps.size(); ++i) {
+        if (i > 0) {
+            text << " > ";
+        }
+        text << stepName(steps[i].kind);
+        if (!steps[i].network.empty()) {
+            text << "(" << steps[i].network << ")";
+        }
+        text << "@" << steps[i].scale << "x";
+    }
+    if (steps.empty()) {
+        text << "copy";
+    }
+    return text.str();
+}
+
+std::vector<std::pair<std::string, std::string>> PipelinePlan::variants() const {
+    std::vector<std::pair<std::string, std::string>> chosen;
+    for (const PlannedStep& step : steps) {
+        if (step.kind == StepKind::Denoise || step.kind == StepKind::SuperResolve) {
+            chosen.emplace_back(step.stage, step.network);
+        } else if (step.kind == StepKind::Resample && step.stage == "superResolution") {
+            chosen.emplace_back(step.stage, "bicubic");
+        } else if (step.kind == StepKind::DetectFaces) {
+            chosen.emplace_back(step.stage, step.network + "@" + std::to_string(step.maxSide));
+        }
+    }
+    return chosen;
+}
+
+std::string stepVariant(const PlannedStep& step) {
+    std::string variant = stepName(step.kind);
+    if (!step.network.empty()) {
+        variant += "(" + step.network + ")";
+    }
+    return variant;
+}
+
+std::string encodeVariant(const std::string& outputFormat) {
+    return "encode(" + outputFormat + ")";
+}
@@ -0,0 +1,77 @@
+﻿// Pipeline_Planner.h : Lays out the enhancement steps in a fixed order and picks their variants.
+
+#pragma once
+
+#include "Photo_Enhancer.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+// The primitive operations a plan is made of.
+enum class StepKind {
+    Sharpen,         // Unsharp mask
+    Resample,        // Resize to the step's scale (bicubic super-resolution)
+    Denoise,         // Tiled non-local means, or the guided filter in "fast" mode, at the current resolution
+    ColorCorrection, // CLAHE on luminance
+    DetectFaces,     // Face detection on a bounded-size proxy, with the step's detector
+    SmoothFaces,     // Edge-preserving smoothing inside the detected face rects
+    SuperResolve,    // Tiled ESPCN / FSRCNN network upscale to the step's scale
+};
+
+struct PlannedStep {
+    StepKind kind;
+    std::string stage;      // User-facing stage this step belongs to ("denoise", "beautify", ...)
+    double scale = 1.0;     // Working resolution relative to the input, after this step
+    int interpolation = 0;  // cv::InterpolationFlags, Resample only
+    std::string network{};  // Network of a SuperResolve step, detector ("haar", "yunet") of a DetectFaces step,
+                            // mode ("nlm", "fast") of a Denoise step
+    double seconds = 0.0;   // Wall time measured by applyEnhancements once the step has run
+    int maxSide = 0;        // Longest side of the detection proxy, DetectFaces only (0 for the configured one)
+    double megapixels = 0.0; // Work of this step as the cost model counts it (input of an upscale, the proxy of a detection)
+};
+
+// An ordered list of steps plus their cost estimates.
+struct PipelinePlan {
+    std::vector<PlannedStep> steps;
+    cv::Size inputSize;
+    cv::Size outputSize;
+    double estimatedCost = 0.0;       // Weighted megapixels processed by this plan
+    int resampleCount = 0;
+    std::vector<std::string> skippedStages; // Requested stages with nothing left to run, e.g. super-resolution over the pixel budget
+    std::vector<std::string> notes;         // Downgrades applied to the request, for logs and clients
+    double deadlineSeconds = 0.0;           // What the request's deadlineMs left for these steps; 0 without a deadline
+    double predictedSeconds = 0.0;          // The latency model's estimate for these steps
+    std::vector<std::string> downgrades;    // Variants swapped for cheaper ones to fit the deadline
+
+    // Stage names in the order their first step runs.
+    std::vector<std::string> stageOrder() const;
+    // Measured seconds of all steps belonging to `stage`.
+    double stageSeconds(const std::string& stage) const;
+    // One-line summary such as "sharpen@1x > denoise@1x > ... > superResolve(ESPCN_x2)@2x".
+    std::string describe() const;
+    // The algorithm each stage with a choice runs, e.g. {"denoise", "fast"}, {"superResolution",
+    // "ESPCN_x2"} or {"beautify", "haar@1024"} (detector and proxy side).
+    std::vector<std::pair<std::string, std::string>> variants() const;
+};
+
+// Latency model key of a step, e.g. "denoise(nlm)" or "superResolve(ESPCN_x2)".
+std::string stepVariant(const PlannedStep& step);
+// Latency model key of encoding to `outputFormat`.
+std::string encodeVariant(const std::string& outputFormat);
+
+// Lays out the steps for the requested stages in a fixed order: sharpen > denoise > color
+// correction > beautify > super-resolution. Every step before the upscale works at the input
+// resolution, so face detection and smoothing no longer run on the upscaled image; denoise is
+// tiled across cores rather than run on a downscaled copy. The order does not depend on the image,
+// only the output scale and the variants do. estimatedCost uses rough per-megapixel weights for
+// each step kind and is only reported.
+//
+// Super-resolution goes through chooseSuperResolution, so the output size respects the pixel
+// budget, and face detection through chooseFaceDetector.
+//
+// With a deadlineMs, the time left since options.startedAt, minus the predicted encode, is the
+// budget for the steps. While the LatencyModel predicts the plan over it, the step variant whose
+// cheaper alternative saves the most is swapped: non-local means for the fast denoise, the
+// network upscale for bicubic, the face detection proxy for one half its side. Each swap is
+// listed in `downgrades` and the notes.
+PipelinePlan planPipeline(const EnhanceOptions& options, cv::Size inputSize);
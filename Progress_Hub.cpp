@@ -0,0 +1,167 @@
+﻿#include "Progress_Hub.h"
+#include <algorithm>
+
+static bool contains(const std::vector<std::string>& items, const std::string& item) {
+    return std::find(items.begin(), items.end(), item) != items.end();
+}
+
+ProgressHub::ProgressHub(Renderer render, std::chrono::milliseconds minInterval)
+    : render_(std::move(render)), minInterval_(minInterval) {
+}
+
+void ProgressHub::subscribe(crow::websocket::connection& conn, std::shared_ptr<Job> job, asio::io_context* ioContext, bool wantsPreview) {
+    auto sub = std::make_shared<Subscription>();
+    sub->conn = &conn;
+    sub->ioContext = ioContext;
+    sub->job = std::move(job);
+    sub->wantsPreview = wantsPreview;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    sub->id = nextId_++;
+    byJob_[sub->job->id()].push_back(sub);
+    byConnection_[&conn] = sub;
+    // Checked after registering, so a job finishing concurrently is caught by one path or the other.
+    JobState state = sub->job->state();
+    sub->finished = state == JobState::Done || state == JobState::Failed;
+    scheduleFlushLocked(sub, true);
+}
+
+void ProgressHub::unsubscribe(crow::websocket::connection& conn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removeLocked(&conn);
+}
+
+void ProgressHub::stageProgress(const std::string& jobId, const std::string& stage, double progress) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byJob_.find(jobId);
+    if (it == byJob_.end()) {
+        return;
+    }
+    for (const std::shared_ptr<Subscription>& sub : it->second) {
+        bool boundary = false;
+        if (!contains(sub->startedStages, stage)) {
+            sub->startedStages.push_back(stage);
+            sub->events.emplace_back(stage, "started");
+            boundary = true;
+        }
+        if (progress >= 1.0 && !contains(sub->finishedStages, stage)) {
+            sub->finishedStages.push_back(stage);
+            sub->events.emplace_back(stage, "finished");
+            boundary = true;
+        }
+        scheduleFlushLocked(sub, boundary);
+    }
+}
+
+bool ProgressHub::wantsPreview(const std::string& jobId) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byJob_.find(jobId);
+    if (it == byJob_.end()) {
+        return false;
+    }
+    return std::any_of(it->second.begin(), it->second.end(), [](const std::shared_ptr<Subscription>& sub) {
+        return sub->wantsPreview;
+    });
+}
+
+void ProgressHub::preview(const std::string& jobId, std::string jpeg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byJob_.find(jobId);
+    if (it == byJob_.end()) {
+        return;
+    }
+    for (const std::shared_ptr<Subscription>& sub : it->second) {
+        if (sub->wantsPreview) {
+            sub->preview = jpeg;
+            scheduleFlushLocked(sub, true);
+        }
+    }
+}
+
+void ProgressHub::jobFinished(const std::string& jobId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byJob_.find(jobId);
+    if (it == byJob_.end()) {
+        return;
+    }
+    for (const std::shared_ptr<Subscription>& sub : it->second) {
+        sub->finished = true;
+        scheduleFlushLocked(sub, true);
+    }
+}
+
+void ProgressHub::scheduleFlushLocked(const std::shared_ptr<Subscription>& sub, bool important) {
+    if (sub->flushPending) {
+        return; // The pending flush will pick up this change too
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!important && now - sub->lastFlush < minInterval_) {
+        return; // Routine update; the next one after the interval carries the latest state
+    }
+    sub->flushPending = true;
+    // Flushes run on the connection's own IO thread, the only thread that may touch it, and
+    // carry the subscription ID so a flush for a closed connection finds nothing.
+    asio::post(*sub->ioContext, [this, conn = sub->conn, id = sub->id]() {
+        flush(conn, id);
+    });
+}
+
+void ProgressHub::flush(crow::websocket::connection* conn, std::uint64_t id) {
+    std::shared_ptr<Subscription> sub;
+    std::vector<std::pair<std::string, std::string>> events;
+    std::string preview;
+    bool finished = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = byConnection_.find(conn);
+        if (it == byConnection_.end() || it->second->id != id) {
+            return;
+        }
+        sub = it->second;
+        sub->flushPending = false;
+        sub->lastFlush = std::chrono::steady_clock::now();
+        events.swap(sub->events);
+        preview.swap(sub->preview);
+        finished = sub->finished;
+        if (finished) {
+            removeLocked(conn);
+        }
+    }
+
+    // Rendering and sending happen outside the lock; the close handler that would invalidate
+    // conn runs on this same thread, so it cannot interleave.
+    crow::json::wvalue message = render_(*sub->job);
+    message["type"] = "progress";
+    std::vector<crow::json::wvalue> eventList;
+    for (auto& [stage, event] : events) {
+        crow::json::wvalue entry;
+        entry["stage"] = stage;
+        entry["event"] = event;
+        eventList.push_back(std::move(entry));
+    }
+    message["events"] = std::move(eventList);
+    conn->send_text(message.dump());
+    if (!preview.empty()) {
+        conn->send_binary(std::move(preview));
+    }
+    if (finished) {
+        conn->close("job finished");
+    }
+}
+
+void ProgressHub::removeLocked(crow::websocket::connection* conn) {
+    auto it = byConnection_.find(conn);
+    if (it == byConnection_.end()) {
+        return;
+    }
+    std::shared_ptr<Subscription> sub = it->second;
+    byConnection_.erase(it);
+    auto jobIt = byJob_.find(sub->job->id());
+    if (jobIt != byJob_.end()) {
+        auto& subs = jobIt->second;
+        subs.erase(std::remove(subs.begin(), subs.end(), sub), subs.end());
+        if (subs.empty()) {
+            byJob_.erase(jobIt);
+        }
+    }
+}
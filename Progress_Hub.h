@@ -0,0 +1,77 @@
+﻿// Progress_Hub.h : Pushes job progress to WebSocket subscribers, coalescing updates per client.
+
+#pragma once
+
+#include "Job_Store.h"
+#include "Crow/crow.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Fans job progress out to the WebSocket clients watching each job.
+//
+// Compute threads only record what changed and, at most once per interval per client, post a
+// flush to the client's IO thread; the flush sends one message with the latest job status and
+// every stage start/finish since the previous message. Tile-level progress in between is
+// coalesced, so a slow client costs the compute thread a map lookup and never a blocking write.
+// Stage boundaries, previews and the final state always get a flush of their own.
+class ProgressHub {
+public:
+    // Builds the status document sent to clients; runs on IO threads.
+    using Renderer = std::function<crow::json::wvalue(const Job&)>;
+
+    ProgressHub(Renderer render, std::chrono::milliseconds minInterval);
+
+    ProgressHub(const ProgressHub&) = delete;
+    ProgressHub& operator=(const ProgressHub&) = delete;
+
+    // IO thread: starts pushing `job` to `conn`. Jobs that are already finished get their final
+    // status right away and the socket is closed.
+    void subscribe(crow::websocket::connection& conn, std::shared_ptr<Job> job, asio::io_context* ioContext, bool wantsPreview);
+    // IO thread, from the close handler: forgets the connection.
+    void unsubscribe(crow::websocket::connection& conn);
+
+    // Compute threads: a stage reported progress (0 = started, 1 = finished).
+    void stageProgress(const std::string& jobId, const std::string& stage, double progress);
+    // Compute threads: true if any client of the job asked for preview frames.
+    bool wantsPreview(const std::string& jobId) const;
+    // Compute threads: replaces the unsent preview frame (JPEG bytes) of the job's clients.
+    void preview(const std::string& jobId, std::string jpeg);
+    // Compute threads: the job is done or failed; clients get the final status and are closed.
+    void jobFinished(const std::string& jobId);
+
+private:
+    struct Subscription {
+        std::uint64_t id = 0;
+        crow::websocket::connection* conn = nullptr;
+        asio::io_context* ioContext = nullptr;
+        std::shared_ptr<Job> job;
+        bool wantsPreview = false;
+        std::vector<std::pair<std::string, std::string>> events; // (stage, "started" | "finished") not yet sent
+        std::vector<std::string> startedStages;
+        std::vector<std::string> finishedStages;
+        std::string preview;
+        bool finished = false;
+        bool flushPending = false;
+        std::chrono::steady_clock::time_point lastFlush;
+    };
+
+    // Posts a flush unless one is pending or, for routine updates, the interval has not passed.
+    // Caller holds mutex_.
+    void scheduleFlushLocked(const std::shared_ptr<Subscription>& sub, bool important);
+    // Runs on the subscription's IO thread.
+    void flush(crow::websocket::connection* conn, std::uint64_t id);
+    void removeLocked(crow::websocket::connection* conn);
+
+    const Renderer render_;
+    const std::chrono::milliseconds minInterval_;
+    mutable std::mutex mutex_;
+    std::uint64_t nextId_ = 1;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Subscription>>> byJob_;
+    std::unordered_map<crow::websocket::connection*, std::shared_ptr<Subscription>> byConnection_;
+};
@@ -0,0 +1,440 @@
+﻿#include "Result_Cache.h"
+#include "Face_Detection.h"
+#include "Super_Resolution.h"
+#include "Tiled_Execution.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t Prime3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+// Bumped whenever the pipeline changes what it produces for the same options, so stale disk
+// entries from an older build are never served.
+constexpr const char* KeyVersion = "v5";
+
+std::string modelFiles_;
+
+std::uint64_t rotateLeft(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads; memcpy keeps them legal for unaligned upload buffers.
+template <typename T>
+T readLittleEndian(const unsigned char* p) {
+    T value = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        std::memcpy(&value, p, sizeof(value));
+    }
+    else {
+        for (std::size_t i = sizeof(value); i-- > 0;) {
+            value = static_cast<T>((value << 8) | p[i]);
+        }
+    }
+    return value;
+}
+
+std::uint64_t read64(const unsigned char* p) {
+    return readLittleEndian<std::uint64_t>(p);
+}
+
+std::uint32_t read32(const unsigned char* p) {
+    return readLittleEndian<std::uint32_t>(p);
+}
+
+std::uint64_t round64(std::uint64_t accumulator, std::uint64_t input) {
+    accumulator += input * Prime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * Prime1;
+}
+
+std::uint64_t mergeRound(std::uint64_t accumulator, std::uint64_t value) {
+    accumulator ^= round64(0, value);
+    return accumulator * Prime1 + Prime4;
+}
+
+std::string toHex(std::uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        hex[static_cast<std::size_t>(i)] = digits[value & 0xF];
+        value >>= 4;
+    }
+    return hex;
+}
+
+// Canonical text for the options and deployment settings that affect the output bytes. Settings
+// that do not apply (the super-resolution model and budget when super resolution is off, the
+// JPEG quality for PNG output) are left out so requests that differ only in those still share
+// an entry.
+std::string normalizeOptions(const EnhanceOptions& options) {
+    std::ostringstream text;
+    text << "sharpen=" << options.sharpen
+         << ";denoise=" << options.denoise
+         << ";colorCorrection=" << options.colorCorrection
+         << ";beautify=" << options.beautify
+         << ";superResolution=" << options.superResolution;
+    if (options.denoise) {
+        text << ";denoiseMode=" << options.denoiseMode;
+    }
+    if (options.colorCorrection) {
+        text << ";claheClipLimit=" << options.claheClipLimit
+             << ";claheTileGrid=" << options.claheTileGrid.width << "x" << options.claheTileGrid.height;
+    }
+    if (options.beautify) {
+        // Resolved, so naming the default detector and naming none share entries.
+        const FaceDetectionSettings& faces = faceDetectionSettings();
+        text << ";faceDetector=" << chooseFaceDetector(options.faceDetector).name
+             << ";faceProxySide=" << faces.maxProxySide
+             << ";minFaceSize=" << faces.minFaceSize
+             << ";yunetScoreThreshold=" << faces.yunetScoreThreshold;
+    }
+    if (options.superResolution) {
+        const SuperResolutionSettings& superResolution = superResolutionSettings();
+        text << ";superResolutionModel=" << options.superResolutionModel
+             << ";superResolutionScale=" << options.superResolutionScale
+             << ";superResolutionMaxPixels=" << superResolution.maxOutputPixels
+             << ";superResolutionTile=" << superResolution.tileSize << "+" << superResolution.tileHalo;
+    }
+    const TiledExecutionSettings& tiled = tiledExecutionSettings();
+    text << ";tiledMegapixels=" << tiled.minMegapixels
+         << ";tiledStripBytes=" << tiled.stripBytes
+         << ";models=" << modelFiles_;
+    // encodeImage writes PNG for "png" and JPEG for anything else, so "jpg", "jpeg" and unknown
+    // formats are one entry.
+    if (options.outputFormat == "png") {
+        text << ";outputFormat=png";
+    }
+    else {
+        text << ";outputFormat=jpeg;jpegQuality=" << (options.jpegQuality > 0 ? options.jpegQuality : 95);
+    }
+    return text.str();
+}
+
+std::string contentTypeForExtension(const std::string& extension) {
+    return extension == "jpg" ? "image/jpeg" : "image/png";
+}
+
+std::size_t entryBytes(const EncodedImage& result) {
+    return result.bytes.size();
+}
+
+} // namespace
+
+XxHash64::XxHash64(std::uint64_t seed) : seed_(seed) {
+    lanes_[0] = seed + Prime1 + Prime2;
+    lanes_[1] = seed + Prime2;
+    lanes_[2] = seed;
+    lanes_[3] = seed - Prime1;
+}
+
+void XxHash64::update(const void* data, std::size_t size) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + size;
+    totalSize_ += size;
+
+    if (bufferSize_ + size < sizeof(buffer_)) {
+        std::memcpy(buffer_ + bufferSize_, p, size);
+        bufferSize_ += size;
+        return;
+    }
+    if (bufferSize_ > 0) {
+        std::size_t fill = sizeof(buffer_) - bufferSize_;
+        std::memcpy(buffer_ + bufferSize_, p, fill);
+        consumeStripe(buffer_);
+        p += fill;
+        bufferSize_ = 0;
+    }
+    while (end - p >= static_cast<std::ptrdiff_t>(sizeof(buffer_))) {
+        consumeStripe(p);
+        p += sizeof(buffer_);
+    }
+    bufferSize_ = static_cast<std::size_t>(end - p);
+    std::memcpy(buffer_, p, bufferSize_);
+}
+
+void XxHash64::consumeStripe(const unsigned char* stripe) {
+    for (int lane = 0; lane < 4; ++lane) {
+        lanes_[lane] = round64(lanes_[lane], read64(stripe + 8 * lane));
+    }
+}
+
+std::uint64_t XxHash64::digest() const {
+    std::uint64_t hash;
+    if (totalSize_ >= sizeof(buffer_)) {
+        hash = rotateLeft(lanes_[0], 1) + rotateLeft(lanes_[1], 7) + rotateLeft(lanes_[2], 12) + rotateLeft(lanes_[3], 18);
+        for (std::uint64_t lane : lanes_) {
+            hash = mergeRound(hash, lane);
+        }
+    }
+    else {
+        hash = seed_ + Prime5;
+    }
+    hash += totalSize_;
+
+    const unsigned char* p = buffer_;
+    const unsigned char* const end = buffer_ + bufferSize_;
+    while (end - p >= 8) {
+        hash ^= round64(0, read64(p));
+        hash = rotateLeft(hash, 27) * Prime1 + Prime4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        hash ^= static_cast<std::uint64_t>(read32(p)) * Prime1;
+        hash = rotateLeft(hash, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= static_cast<std::uint64_t>(*p) * Prime5;
+        hash = rotateLeft(hash, 11) * Prime1;
+        ++p;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::uint64_t xxhash64(const void* data, std::size_t size, std::uint64_t seed) {
+    XxHash64 state(seed);
+    state.update(data, size);
+    return state.digest();
+}
+
+void configureResultCacheModels(const std::string& modelFiles) {
+    modelFiles_ = modelFiles;
+}
+
+ResultCache::ResultCache(std::size_t memoryBytes, std::size_t diskBytes, fs::path diskDirectory)
+    : memoryBudget_(memoryBytes), diskBudget_(diskBytes), diskDirectory_(std::move(diskDirectory)) {
+    if (diskBudget_ > 0) {
+        loadDiskIndex();
+    }
+}
+
+std::string ResultCache::makeKey(const char* data, std::size_t size, const EnhanceOptions& options) {
+    return makeKey(xxhash64(data, size), size, options);
+}
+
+std::string ResultCache::makeKey(std::uint64_t contentHash, std::size_t size, const EnhanceOptions& options) {
+    std::string normalized = std::string(KeyVersion) + ";" + normalizeOptions(options);
+    // The byte count goes into the key as well, so a collision would also need equal sizes.
+    return toHex(contentHash) + "-" + std::to_string(size) + "-" + toHex(xxhash64(normalized.data(), normalized.size()));
+}
+
+std::shared_ptr<const EncodedImage> ResultCache::findInMemory(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = memoryIndex_.find(key);
+    if (found == memoryIndex_.end()) {
+        return nullptr;
+    }
+    memoryLru_.splice(memoryLru_.begin(), memoryLru_, found->second);
+    ++counters_.memoryHits;
+    return found->second->result;
+}
+
+std::shared_ptr<const EncodedImage> ResultCache::find(const std::string& key) {
+    fs::path diskPath;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = memoryIndex_.find(key);
+        if (found != memoryIndex_.end()) {
+            memoryLru_.splice(memoryLru_.begin(), memoryLru_, found->second);
+            ++counters_.memoryHits;
+            return found->second->result;
+        }
+        auto onDisk = diskIndex_.find(key);
+        if (onDisk == diskIndex_.end()) {
+            ++counters_.misses;
+            return nullptr;
+        }
+        diskLru_.splice(diskLru_.begin(), diskLru_, onDisk->second);
+        diskPath = onDisk->second->path;
+    }
+
+    std::shared_ptr<const EncodedImage> result = readFromDisk(diskPath);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!result) {
+        // Removed behind our back; forget it so the next lookup does not try again.
+        auto onDisk = diskIndex_.find(key);
+        if (onDisk != diskIndex_.end()) {
+            diskBytes_ -= onDisk->second->bytes;
+            diskLru_.erase(onDisk->second);
+            diskIndex_.erase(onDisk);
+        }
+        ++counters_.misses;
+        return nullptr;
+    }
+    ++counters_.diskHits;
+    insertInMemoryLocked(key, result);
+    return result;
+}
+
+void ResultCache::insert(const std::string& key, std::shared_ptr<const EncodedImage> result) {
+    if (!result || result->bytes.empty()) {
+        return;
+    }
+    bool writeDisk = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insertInMemoryLocked(key, result);
+        writeDisk = diskBudget_ > 0 && entryBytes(*result) <= diskBudget_ && diskIndex_.count(key) == 0;
+    }
+    if (writeDisk) {
+        writeToDisk(key, *result);
+    }
+}
+
+void ResultCache::insertInMemoryLocked(const std::string& key, std::shared_ptr<const EncodedImage> result) {
+    std::size_t bytes = entryBytes(*result);
+    if (bytes > memoryBudget_ || memoryIndex_.count(key) != 0) {
+        return;
+    }
+    memoryLru_.push_front(MemoryEntry{ key, std::move(result) });
+    memoryIndex_[key] = memoryLru_.begin();
+    memoryBytes_ += bytes;
+    while (memoryBytes_ > memoryBudget_ && !memoryLru_.empty()) {
+        const MemoryEntry& oldest = memoryLru_.back();
+        memoryBytes_ -= entryBytes(*oldest.result);
+        memoryIndex_.erase(oldest.key);
+        memoryLru_.pop_back();
+        ++counters_.memoryEvictions;
+    }
+}
+
+void ResultCache::writeToDisk(const std::string& key, const EncodedImage& result) {
+    fs::path path = diskDirectory_ / (key + "." + result.extension);
+    // Written under a temporary name and renamed, so a crash never leaves a truncated entry
+    // that loadDiskIndex would pick up.
+    fs::path partial = path;
+    partial += ".part";
+    {
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        if (!out.write(result.bytes.data(), static_cast<std::streamsize>(result.bytes.size()))) {
+            std::cerr << "[Cache] Could not write " << partial << std::endl;
+            std::error_code ignored;
+            fs::remove(partial, ignored);
+            return;
+        }
+    }
+    std::error_code error;
+    fs::rename(partial, path, error);
+    if (error) {
+        std::cerr << "[Cache] Could not store " << path << ": " << error.message() << std::endl;
+        fs::remove(partial, error);
+        return;
+    }
+
+    std::vector<fs::path> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (diskIndex_.count(key) != 0) {
+            return; // Another worker stored the same result meanwhile
+        }
+        diskLru_.push_front(DiskEntry{ key, path, result.bytes.size() });
+        diskIndex_[key] = diskLru_.begin();
+        diskBytes_ += result.bytes.size();
+        while (diskBytes_ > diskBudget_ && !diskLru_.empty()) {
+            const DiskEntry& oldest = diskLru_.back();
+            diskBytes_ -= oldest.bytes;
+            evicted.push_back(oldest.path);
+            diskIndex_.erase(oldest.key);
+            diskLru_.pop_back();
+            ++counters_.diskEvictions;
+        }
+    }
+    for (const fs::path& file : evicted) {
+        std::error_code ignored;
+        fs::remove(file, ignored);
+    }
+}
+
+std::shared_ptr<const EncodedImage> ResultCache::readFromDisk(const fs::path& path) const {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return nullptr;
+    }
+    auto result = std::make_shared<EncodedImage>();
+    result->bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (result->bytes.empty()) {
+        return nullptr;
+    }
+    result->extension = path.extension().string().substr(1);
+    result->contentType = contentTypeForExtension(result->extension);
+    result->etag = "\"" + path.stem().string() + "\"";
+    return result;
+}
+
+// Rebuilds the disk tier from the files a previous run left behind, oldest modification time
+// last in the LRU, and trims it to the current budget.
+void ResultCache::loadDiskIndex() {
+    std::error_code error;
+    fs::create_directories(diskDirectory_, error);
+    if (error) {
+        std::cerr << "[Cache] Disk cache disabled, cannot create " << diskDirectory_ << ": " << error.message() << std::endl;
+        return;
+    }
+
+    struct Found {
+        DiskEntry entry;
+        fs::file_time_type modified;
+    };
+    std::vector<Found> files;
+    for (const fs::directory_entry& file : fs::directory_iterator(diskDirectory_, error)) {
+        const fs::path& path = file.path();
+        std::string extension = path.extension().string();
+        if (!file.is_regular_file(error) || (extension != ".png" && extension != ".jpg")) {
+            if (extension == ".part") {
+                fs::remove(path, error);
+            }
+            continue;
+        }
+        std::uintmax_t bytes = file.file_size(error);
+        if (error || bytes == 0) {
+            continue;
+        }
+        files.push_back(Found{ DiskEntry{ path.stem().string(), path, static_cast<std::size_t>(bytes) }, file.last_write_time(error) });
+    }
+    std::sort(files.begin(), files.end(), [](const Found& a, const Found& b) { return a.modified > b.modified; });
+
+    for (Found& found : files) {
+        if (diskIndex_.count(found.entry.key) != 0) {
+            continue;
+        }
+        if (diskBytes_ + found.entry.bytes > diskBudget_) {
+            fs::remove(found.entry.path, error);
+            continue;
+        }
+        diskBytes_ += found.entry.bytes;
+        diskLru_.push_back(std::move(found.entry));
+        diskIndex_[diskLru_.back().key] = std::prev(diskLru_.end());
+    }
+    std::cout << "[Cache] Disk cache at " << diskDirectory_ << ": " << diskLru_.size() << " results, " << diskBytes_ << " bytes" << std::endl;
+}
+
+CacheStats ResultCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheStats stats = counters_;
+    stats.memoryEntries = memoryLru_.size();
+    stats.memoryBytes = memoryBytes_;
+    stats.diskEntries = diskLru_.size();
+    stats.diskBytes = diskBytes_;
+    return stats;
+}
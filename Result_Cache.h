@@ -0,0 +1,108 @@
+﻿// Result_Cache.h : Content-addressed cache of encoded results, keyed by input bytes and options.
+
+#pragma once
+
+#include "Photo_Enhancer.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Streaming XXH64, as specified by the xxHash project, for input that arrives in pieces.
+class XxHash64 {
+public:
+    explicit XxHash64(std::uint64_t seed = 0);
+
+    void update(const void* data, std::size_t size);
+    std::uint64_t digest() const;
+
+private:
+    void consumeStripe(const unsigned char* stripe);
+
+    std::uint64_t seed_;
+    std::uint64_t lanes_[4];
+    std::uint64_t totalSize_ = 0;
+    unsigned char buffer_[32];
+    std::size_t bufferSize_ = 0;
+};
+
+// XXH64 of a byte range.
+std::uint64_t xxhash64(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+// Names the model files this deployment loaded, so results made with other models never share
+// a key with its own. Call once at startup, before the first key is made.
+void configureResultCacheModels(const std::string& modelFiles);
+
+struct CacheStats {
+    std::uint64_t memoryHits = 0;
+    std::uint64_t diskHits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t memoryEvictions = 0;
+    std::uint64_t diskEvictions = 0;
+    std::size_t memoryEntries = 0;
+    std::size_t memoryBytes = 0;
+    std::size_t diskEntries = 0;
+    std::size_t diskBytes = 0;
+};
+
+// Encoded results keyed by a hash of the uploaded bytes plus the normalized options, so the same
+// photo submitted again with the same options is answered without decoding or processing it.
+// An LRU tier in memory shares the EncodedImage with the job store; an optional disk tier keeps
+// results across restarts and memory evictions. Both tiers evict least recently used entries
+// once over their byte budget. All methods are thread-safe; disk reads and writes happen
+// outside the lock.
+class ResultCache {
+public:
+    // A diskBytes of 0 disables the disk tier.
+    ResultCache(std::size_t memoryBytes, std::size_t diskBytes, std::filesystem::path diskDirectory);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Cache key for these upload bytes processed with these options.
+    static std::string makeKey(const char* data, std::size_t size, const EnhanceOptions& options);
+    // The same key from an XXH64 (seed 0) computed while the upload streamed in.
+    static std::string makeKey(std::uint64_t contentHash, std::size_t size, const EnhanceOptions& options);
+
+    // Memory tier only; cheap enough for IO threads. Counts hits but not misses.
+    std::shared_ptr<const EncodedImage> findInMemory(const std::string& key);
+    // Memory, then disk; a disk hit is promoted to memory. Counts hits and misses.
+    std::shared_ptr<const EncodedImage> find(const std::string& key);
+    // Stores a result in memory and, if enabled, on disk. Results over a tier's budget skip it.
+    void insert(const std::string& key, std::shared_ptr<const EncodedImage> result);
+
+    CacheStats stats() const;
+
+private:
+    struct MemoryEntry {
+        std::string key;
+        std::shared_ptr<const EncodedImage> result;
+    };
+    struct DiskEntry {
+        std::string key;
+        std::filesystem::path path;
+        std::size_t bytes = 0;
+    };
+
+    void insertInMemoryLocked(const std::string& key, std::shared_ptr<const EncodedImage> result);
+    void writeToDisk(const std::string& key, const EncodedImage& result);
+    std::shared_ptr<const EncodedImage> readFromDisk(const std::filesystem::path& path) const;
+    void loadDiskIndex();
+
+    const std::size_t memoryBudget_;
+    const std::size_t diskBudget_;
+    const std::filesystem::path diskDirectory_;
+
+    mutable std::mutex mutex_;
+    std::list<MemoryEntry> memoryLru_; // Most recently used first
+    std::unordered_map<std::string, std::list<MemoryEntry>::iterator> memoryIndex_;
+    std::size_t memoryBytes_ = 0;
+    std::list<DiskEntry> diskLru_;
+    std::unordered_map<std::string, std::list<DiskEntry>::iterator> diskIndex_;
+    std::size_t diskBytes_ = 0;
+    CacheStats counters_;
+};
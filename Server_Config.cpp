@@ -0,0 +1,97 @@
+﻿#include "Server_Config.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Reads a positive integer (or zero, when allowed) from the environment, keeping the fallback if
+// it is unset or invalid.
+static unsigned long long readEnvNumber(const char* name, unsigned long long fallback, bool allowZero = false) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return fallback;
+    }
+    try {
+        std::size_t parsed = 0;
+        unsigned long long number = std::stoull(value, &parsed);
+        if (parsed == std::string(value).size() && (number > 0 || allowZero)) {
+            return number;
+        }
+    }
+    catch (const std::exception&) {
+    }
+    std::cerr << "[Config] Ignoring invalid " << name << "=" << value << std::endl;
+    return fallback;
+}
+
+ServerConfig ServerConfig::fromEnvironment() {
+    ServerConfig config;
+    config.port = static_cast<std::uint16_t>(readEnvNumber("PHOTO_ENHANCER_PORT", config.port));
+    config.ioThreads = static_cast<unsigned>(readEnvNumber("PHOTO_ENHANCER_IO_THREADS", config.ioThreads));
+    unsigned cores = std::thread::hardware_concurrency();
+    config.computeThreads = static_cast<unsigned>(readEnvNumber("PHOTO_ENHANCER_COMPUTE_THREADS", cores > 0 ? cores : 2));
+    config.computeQueueDepth = readEnvNumber("PHOTO_ENHANCER_QUEUE_DEPTH", config.computeQueueDepth);
+    config.maxStoredJobs = readEnvNumber("PHOTO_ENHANCER_MAX_JOBS", config.maxStoredJobs);
+    config.maxStoredBytes = readEnvNumber("PHOTO_ENHANCER_MAX_RESULT_BYTES", config.maxStoredBytes);
+    if (const char* cascadePath = std::getenv("PHOTO_ENHANCER_FACE_CASCADE")) {
+        config.faceCascadePath = cascadePath;
+    }
+    if (const char* modelDir = std::getenv("PHOTO_ENHANCER_SR_MODEL_DIR")) {
+        config.superResolutionModelDir = modelDir;
+    }
+    config.superResolutionMaxMegapixels = readEnvNumber("PHOTO_ENHANCER_SR_MAX_MEGAPIXELS", config.superResolutionMaxMegapixels);
+    config.superResolutionTileSize = static_cast<int>(readEnvNumber("PHOTO_ENHANCER_SR_TILE", config.superResolutionTileSize));
+    config.superResolutionBatchSize = static_cast<int>(readEnvNumber("PHOTO_ENHANCER_SR_BATCH", config.superResolutionBatchSize));
+    config.resultCacheBytes = readEnvNumber("PHOTO_ENHANCER_CACHE_BYTES", config.resultCacheBytes);
+    config.diskCacheBytes = readEnvNumber("PHOTO_ENHANCER_DISK_CACHE_BYTES", config.diskCacheBytes);
+    if (const char* cacheDir = std::getenv("PHOTO_ENHANCER_DISK_CACHE_DIR")) {
+        config.diskCacheDir = cacheDir;
+    }
+    config.maxUploadBytes = readEnvNumber("PHOTO_ENHANCER_MAX_UPLOAD_BYTES", config.maxUploadBytes);
+    config.uploadMemoryBytes = readEnvNumber("PHOTO_ENHANCER_UPLOAD_BUFFER_BYTES", config.uploadMemoryBytes);
+    config.maxBatchFiles = readEnvNumber("PHOTO_ENHANCER_BATCH_MAX_FILES", config.maxBatchFiles);
+    config.maxBatchBytes = readEnvNumber("PHOTO_ENHANCER_MAX_BATCH_BYTES", config.maxBatchBytes);
+    config.tiledMinMegapixels = readEnvNumber("PHOTO_ENHANCER_TILED_MEGAPIXELS", config.tiledMinMegapixels);
+    config.tiledStripBytes = readEnvNumber("PHOTO_ENHANCER_TILED_STRIP_BYTES", config.tiledStripBytes);
+    config.matPoolBytes = readEnvNumber("PHOTO_ENHANCER_MAT_POOL_BYTES", config.matPoolBytes, true);
+    config.matPoolHugePages = readEnvNumber("PHOTO_ENHANCER_MAT_POOL_HUGE_PAGES", config.matPoolHugePages, true) != 0;
+    config.faceProxySide = static_cast<int>(readEnvNumber("PHOTO_ENHANCER_FACE_PROXY_SIDE", config.faceProxySide));
+    config.minFaceSize = static_cast<int>(readEnvNumber("PHOTO_ENHANCER_MIN_FACE_SIZE", config.minFaceSize));
+    if (const char* detector = std::getenv("PHOTO_ENHANCER_FACE_DETECTOR")) {
+        config.faceDetector = detector;
+    }
+    if (const char* yunetModel = std::getenv("PHOTO_ENHANCER_FACE_YUNET_MODEL")) {
+        config.faceYuNetModelPath = yunetModel;
+    }
+    return config;
+}
+
+SuperResolutionSettings ServerConfig::superResolutionSettings() const {
+    SuperResolutionSettings settings;
+    settings.maxOutputPixels = superResolutionMaxMegapixels * 1'000'000;
+    settings.tileSize = superResolutionTileSize;
+    settings.batchSize = superResolutionBatchSize;
+    return settings;
+}
+
+MatPoolSettings ServerConfig::matPoolSettings() const {
+    MatPoolSettings settings;
+    settings.retainedBytes = matPoolBytes;
+    settings.hugePages = matPoolHugePages;
+    return settings;
+}
+
+TiledExecutionSettings ServerConfig::tiledExecutionSettings() const {
+    TiledExecutionSettings settings;
+    settings.minMegapixels = (double)tiledMinMegapixels;
+    settings.stripBytes = tiledStripBytes;
+    return settings;
+}
+
+FaceDetectionSettings ServerConfig::faceDetectionSettings() const {
+    FaceDetectionSettings settings;
+    settings.maxProxySide = faceProxySide;
+    settings.minFaceSize = minFaceSize;
+    settings.detector = faceDetector;
+    return settings;
+}
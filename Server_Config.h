@@ -0,0 +1,52 @@
+﻿// Server_Config.h : Runtime settings for the HTTP server, read from the environment.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Face_Detection.h"
+#include "Mat_Pool.h"
+#include "Super_Resolution.h"
+#include "Tiled_Execution.h"
+
+struct ServerConfig {
+    std::uint16_t port = 8080;             // PHOTO_ENHANCER_PORT
+    unsigned ioThreads = 2;                // PHOTO_ENHANCER_IO_THREADS: Crow connection threads
+    unsigned computeThreads = 0;           // PHOTO_ENHANCER_COMPUTE_THREADS: enhancement workers (0 = one per core)
+    std::size_t computeQueueDepth = 64;    // PHOTO_ENHANCER_QUEUE_DEPTH: jobs waiting for a worker before new ones get 503
+    std::size_t maxStoredJobs = 256;       // PHOTO_ENHANCER_MAX_JOBS: results kept in the job store
+    std::size_t maxStoredBytes = 1 << 30;  // PHOTO_ENHANCER_MAX_RESULT_BYTES: byte budget of the job store
+    std::string faceCascadePath = "haarcascade_frontalface_default.xml"; // PHOTO_ENHANCER_FACE_CASCADE
+    std::string superResolutionModelDir = "models"; // PHOTO_ENHANCER_SR_MODEL_DIR: holds ESPCN_x2.onnx, FSRCNN_x4.onnx, ...
+    std::size_t superResolutionMaxMegapixels = 64;  // PHOTO_ENHANCER_SR_MAX_MEGAPIXELS: largest super-resolution output
+    int superResolutionTileSize = 256;              // PHOTO_ENHANCER_SR_TILE: input pixels per inference tile side
+    int superResolutionBatchSize = 4;               // PHOTO_ENHANCER_SR_BATCH: tiles per forward pass
+    std::size_t resultCacheBytes = 256 << 20;       // PHOTO_ENHANCER_CACHE_BYTES: in-memory result cache budget
+    std::size_t diskCacheBytes = 0;                 // PHOTO_ENHANCER_DISK_CACHE_BYTES: on-disk result cache budget (0 = off)
+    std::string diskCacheDir = "uploads/cache";     // PHOTO_ENHANCER_DISK_CACHE_DIR
+    std::size_t maxUploadBytes = 256 << 20;         // PHOTO_ENHANCER_MAX_UPLOAD_BYTES: larger upload bodies get 413
+    std::size_t uploadMemoryBytes = 8 << 20;        // PHOTO_ENHANCER_UPLOAD_BUFFER_BYTES: upload bytes held in memory before spilling to disk
+    std::size_t maxBatchFiles = 64;                 // PHOTO_ENHANCER_BATCH_MAX_FILES: images accepted by one POST /api/batch
+    std::size_t maxBatchBytes = 1 << 30;            // PHOTO_ENHANCER_MAX_BATCH_BYTES: larger batch bodies get 413
+    std::size_t tiledMinMegapixels = 16;            // PHOTO_ENHANCER_TILED_MEGAPIXELS: images this large run each stage in strips
+    std::size_t tiledStripBytes = 16 << 20;         // PHOTO_ENHANCER_TILED_STRIP_BYTES: input bytes per strip in tiled execution
+    std::size_t matPoolBytes = 256 << 20;           // PHOTO_ENHANCER_MAT_POOL_BYTES: free image buffers kept for reuse (0 = off)
+    bool matPoolHugePages = false;                  // PHOTO_ENHANCER_MAT_POOL_HUGE_PAGES: 1 backs pooled buffers with transparent huge pages
+    int faceProxySide = 1024;                       // PHOTO_ENHANCER_FACE_PROXY_SIDE: longest side of the image face detection runs on
+    int minFaceSize = 80;                           // PHOTO_ENHANCER_MIN_FACE_SIZE: smallest face beautify looks for, in input pixels
+    std::string faceDetector = "haar";              // PHOTO_ENHANCER_FACE_DETECTOR: default beautify backend, "haar" or "yunet"
+    std::string faceYuNetModelPath = "models/face_detection_yunet_2023mar.onnx"; // PHOTO_ENHANCER_FACE_YUNET_MODEL
+
+    // Starts from the defaults above and overrides whatever is set in the environment.
+    static ServerConfig fromEnvironment();
+
+    // The super-resolution fields above, in the form configureSuperResolution takes.
+    SuperResolutionSettings superResolutionSettings() const;
+    // The Mat pool fields above, in the form MatPool::install takes.
+    MatPoolSettings matPoolSettings() const;
+    // The tiled execution fields above, in the form configureTiledExecution takes.
+    TiledExecutionSettings tiledExecutionSettings() const;
+    // The face detection fields above, in the form configureFaceDetection takes.
+    FaceDetectionSettings faceDetectionSettings() const;
+};
@@ -0,0 +1,179 @@
+﻿#include "Super_Resolution.h"
+#include "Model_Registry.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include <opencv2/dnn.hpp>
+#include <opencv2/imgproc.hpp>
+
+static SuperResolutionSettings settings_;
+
+static const char* const ModelFamilies[] = {"ESPCN", "FSRCNN"};
+static const int ModelScales[] = {2, 3, 4};
+
+void configureSuperResolution(const SuperResolutionSettings& settings) {
+    settings_ = settings;
+    settings_.tileSize = std::max(settings_.tileSize, 32);
+    settings_.tileHalo = std::max(settings_.tileHalo, 0);
+    settings_.batchSize = std::max(settings_.batchSize, 1);
+}
+
+const SuperResolutionSettings& superResolutionSettings() {
+    return settings_;
+}
+
+std::string superResolutionNetworkName(const std::string& model, int scale) {
+    std::string family = model;
+    std::transform(family.begin(), family.end(), family.begin(), [](unsigned char c) { return (char)std::toupper(c); });
+    return family + "_x" + std::to_string(scale);
+}
+
+int registerSuperResolutionNetworks(const std::string& directory) {
+    int loaded = 0;
+    for (const char* family : ModelFamilies) {
+        for (int scale : ModelScales) {
+            std::string name = superResolutionNetworkName(family, scale);
+            std::filesystem::path path = std::filesystem::path(directory) / (name + ".onnx");
+            if (!std::filesystem::exists(path)) {
+                continue;
+            }
+            ModelRegistry::instance().registerNetwork(name, path.string());
+            ++loaded;
+        }
+    }
+    if (loaded == 0) {
+        std::cout << "[SuperRes] No networks in " << directory << ", super-resolution will use bicubic" << std::endl;
+    }
+    return loaded;
+}
+
+SuperResolutionChoice chooseSuperResolution(const std::string& model, int requestedScale, cv::Size inputSize) {
+    SuperResolutionChoice choice;
+    double inputPixels = (double)inputSize.width * inputSize.height;
+    for (int scale = std::clamp(requestedScale, 2, 4); scale >= 2; --scale) {
+        if (inputPixels * scale * scale <= (double)settings_.maxOutputPixels) {
+            choice.scale = scale;
+            break;
+        }
+    }
+    if (choice.scale == 1) {
+        choice.note = "super-resolution skipped: output over the pixel budget";
+        return choice;
+    }
+    if (choice.scale != requestedScale) {
+        choice.note = "super-resolution reduced to x" + std::to_string(choice.scale) + " by the pixel budget";
+    }
+    if (model == "bicubic") {
+        return choice;
+    }
+    std::string network = superResolutionNetworkName(model, choice.scale);
+    if (ModelRegistry::instance().hasModel(network)) {
+        choice.network = network;
+    } else {
+        if (!choice.note.empty()) {
+            choice.note += "; ";
+        }
+        choice.note += network + " not loaded, using bicubic";
+    }
+    return choice;
+}
+
+// Runs one forward pass over a batch of equally sized float tiles and returns the upscaled
+// tiles. Falls back to one pass per tile if the network was exported with a fixed batch of 1.
+static std::vector<cv::Mat> inferTiles(cv::dnn::Net& net, const std::vector<cv::Mat>& tiles) {
+    std::vector<cv::Mat> outputs;
+    auto unpack = [&outputs](const cv::Mat& blob) {
+        // N x 1 x H x W; each image is a contiguous plane.
+        for (int n = 0; n < blob.size[0]; ++n) {
+            outputs.push_back(cv::Mat(blob.size[2], blob.size[3], CV_32F, const_cast<float*>(blob.ptr<float>(n))).clone());
+        }
+    };
+    if (tiles.size() > 1) {
+        try {
+            net.setInput(cv::dnn::blobFromImages(tiles));
+            unpack(net.forward());
+            return outputs;
+        }
+        catch (const cv::Exception&) {
+            outputs.clear();
+        }
+    }
+    for (const cv::Mat& tile : tiles) {
+        net.setInput(cv::dnn::blobFromImage(tile));
+        unpack(net.forward());
+    }
+    return outputs;
+}
+
+// Upscales a float luminance plane in [0, 1] and returns the 8-bit result.
+static cv::Mat superResolveLuma(const cv::Mat& luma, const std::string& network, int factor, const std::function<void(double)>& onProgress) {
+    const int tile = std::min(settings_.tileSize, std::max(luma.cols, luma.rows));
+    const int halo = settings_.tileHalo;
+    const int tilesX = (luma.cols + tile - 1) / tile;
+    const int tilesY = (luma.rows + tile - 1) / tile;
+    const int tileCount = tilesX * tilesY;
+    const int batchSize = settings_.batchSize;
+    const int batchCount = (tileCount + batchSize - 1) / batchSize;
+
+    // Reflect-pad so every tile, including the ones on the right and bottom edges, has the same
+    // size and therefore fits in one batch blob.
+    cv::Mat padded;
+    cv::copyMakeBorder(luma, padded, halo, halo + tilesY * tile - luma.rows, halo, halo + tilesX * tile - luma.cols, cv::BORDER_REFLECT_101);
+
+    cv::Mat upscaled(luma.rows * factor, luma.cols * factor, CV_8UC1);
+    const cv::Rect outputBounds(0, 0, upscaled.cols, upscaled.rows);
+    std::atomic<int> tilesDone{0};
+
+    // Tiles write disjoint regions of `upscaled`, so batches need no locking.
+    cv::parallel_for_(cv::Range(0, batchCount), [&](const cv::Range& range) {
+        cv::dnn::Net* net = ModelRegistry::instance().network(network);
+        if (!net) {
+            CV_Error(cv::Error::StsError, "Super-resolution network '" + network + "' is not available");
+        }
+        for (int batch = range.start; batch < range.end; ++batch) {
+            const int first = batch * batchSize;
+            const int last = std::min(first + batchSize, tileCount);
+            std::vector<cv::Mat> inputs;
+            for (int index = first; index < last; ++index) {
+                int x = (index % tilesX) * tile;
+                int y = (index / tilesX) * tile;
+                inputs.push_back(padded(cv::Rect(x, y, tile + 2 * halo, tile + 2 * halo)));
+            }
+            std::vector<cv::Mat> outputs = inferTiles(*net, inputs);
+            for (int index = first; index < last; ++index) {
+                cv::Rect target = cv::Rect((index % tilesX) * tile * factor, (index / tilesX) * tile * factor, tile * factor, tile * factor) & outputBounds;
+                cv::Mat core = outputs[index - first](cv::Rect(halo * factor, halo * factor, target.width, target.height));
+                core.convertTo(upscaled(target), CV_8U, 255.0);
+            }
+            int done = tilesDone.fetch_add(last - first) + (last - first);
+            if (onProgress) {
+                onProgress((double)done / tileCount);
+            }
+        }
+    });
+    return upscaled;
+}
+
+cv::Mat superResolve(const cv::Mat& image, const std::string& network, int factor, const std::function<void(double)>& onProgress) {
+    std::cout << "[SuperRes] " << network << " on " << image.cols << "x" << image.rows << std::endl;
+    cv::Mat ycrcb;
+    cv::cvtColor(image, ycrcb, cv::COLOR_BGR2YCrCb);
+    std::vector<cv::Mat> channels;
+    cv::split(ycrcb, channels);
+
+    cv::Mat luma;
+    channels[0].convertTo(luma, CV_32F, 1.0 / 255.0);
+    channels[0] = superResolveLuma(luma, network, factor, onProgress);
+    for (std::size_t c = 1; c < channels.size(); ++c) {
+        cv::resize(channels[c], channels[c], channels[0].size(), 0, 0, cv::INTER_CUBIC);
+    }
+
+    cv::Mat upscaled;
+    cv::merge(channels, upscaled);
+    cv::cvtColor(upscaled, upscaled, cv::COLOR_YCrCb2BGR);
+    std::cout << "[SuperRes] Upscaled to " << upscaled.cols << "x" << upscaled.rows << std::endl;
+    return upscaled;
+}
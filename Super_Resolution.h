@@ -0,0 +1,45 @@
+﻿// Super_Resolution.h : Tiled, multithreaded super-resolution with ESPCN / FSRCNN ONNX networks.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <opencv2/core.hpp>
+
+// Deployment-wide super-resolution settings, set once at startup before any job runs.
+struct SuperResolutionSettings {
+    std::size_t maxOutputPixels = 64'000'000; // Pixel budget of an upscaled image; larger outputs use a smaller factor
+    int tileSize = 256;                       // Input pixels per tile side, before the halo
+    int tileHalo = 8;                         // Context pixels around each tile, cropped after inference
+    int batchSize = 4;                        // Tiles per forward pass
+};
+
+// What the pipeline will actually run for a super-resolution request.
+struct SuperResolutionChoice {
+    std::string network; // Registry name such as "ESPCN_x2"; empty means bicubic
+    int scale = 1;       // Output size relative to the input; 1 when the budget rules out any upscale
+    std::string note;    // Why the request was downgraded, empty if it was not
+};
+
+void configureSuperResolution(const SuperResolutionSettings& settings);
+const SuperResolutionSettings& superResolutionSettings();
+
+// Registry name of a network file, e.g. ("fsrcnn", 3) -> "FSRCNN_x3".
+std::string superResolutionNetworkName(const std::string& model, int scale);
+
+// Registers every ESPCN_x{2,3,4}.onnx and FSRCNN_x{2,3,4}.onnx found in `directory` and returns
+// how many were loaded. Missing files are skipped, broken ones throw std::runtime_error.
+int registerSuperResolutionNetworks(const std::string& directory);
+
+// Picks the network and factor for `model` ("espcn", "fsrcnn" or "bicubic") at the requested
+// scale. The factor drops until the output fits the pixel budget, and the request falls back to
+// bicubic when the network for the resulting factor is not loaded.
+SuperResolutionChoice chooseSuperResolution(const std::string& model, int requestedScale, cv::Size inputSize);
+
+// Upscales a BGR image by `factor` with the named network. The network runs on luminance only;
+// chroma is resized bicubically, as ESPCN and FSRCNN were trained. The image is cut into
+// equal tiles with a halo wider than the network's receptive field, batches of tiles run on
+// OpenCV's worker threads, and only each tile's core is kept, so neighbouring tiles join
+// without seams. `onProgress` receives the fraction of tiles done, from worker threads.
+cv::Mat superResolve(const cv::Mat& image, const std::string& network, int factor, const std::function<void(double)>& onProgress = nullptr);
@@ -0,0 +1,35 @@
+﻿#include "Tiled_Denoise.h"
+#include <algorithm>
+#include <atomic>
+#include <opencv2/photo.hpp>
+
+cv::Mat denoiseTiled(const cv::Mat& image, const NlmParameters& params, int tileSize, const std::function<void(double)>& onProgress) {
+    const int tile = std::max(tileSize, params.searchWindow);
+    const int halo = params.halo();
+    const int tilesX = (image.cols + tile - 1) / tile;
+    const int tilesY = (image.rows + tile - 1) / tile;
+    const int tileCount = tilesX * tilesY;
+    const cv::Rect bounds(0, 0, image.cols, image.rows);
+
+    // Tiles read from `image` and write disjoint cores of `denoised`, so they need no locking.
+    cv::Mat denoised(image.size(), image.type());
+    std::atomic<int> tilesDone{0};
+    cv::parallel_for_(cv::Range(0, tileCount), [&](const cv::Range& range) {
+        for (int index = range.start; index < range.end; ++index) {
+            cv::Rect core = cv::Rect((index % tilesX) * tile, (index / tilesX) * tile, tile, tile) & bounds;
+            // Clipping the halo at the image border leaves the denoiser to extrapolate there,
+            // exactly as it does for a full-image call.
+            cv::Rect extended = cv::Rect(core.x - halo, core.y - halo, core.width + 2 * halo, core.height + 2 * halo) & bounds;
+
+            cv::Mat result;
+            cv::fastNlMeansDenoisingColored(image(extended), result, params.h, params.hColor, params.templateWindow, params.searchWindow);
+            result(cv::Rect(core.x - extended.x, core.y - extended.y, core.width, core.height)).copyTo(denoised(core));
+
+            int done = tilesDone.fetch_add(1) + 1;
+            if (onProgress) {
+                onProgress((double)done / tileCount);
+            }
+        }
+    });
+    return denoised;
+}
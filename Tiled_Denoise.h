@@ -0,0 +1,25 @@
+﻿// Tiled_Denoise.h : Full-resolution non-local means denoising, split into tiles across cores.
+
+#pragma once
+
+#include <functional>
+#include <opencv2/core.hpp>
+
+// Parameters of cv::fastNlMeansDenoisingColored.
+struct NlmParameters {
+    float h = 2.0f;          // Luminance filter strength
+    float hColor = 2.0f;     // Chroma filter strength
+    int templateWindow = 5;  // Patch side compared between pixels (odd)
+    int searchWindow = 11;   // Neighbourhood side searched for similar patches (odd)
+
+    // Pixels around an output pixel that its value depends on.
+    int halo() const { return searchWindow / 2 + templateWindow / 2; }
+};
+
+// Denoises a BGR image at full resolution with non-local means. The image is cut into tiles of
+// `tileSize` pixels, each extended by the parameters' halo, and the tiles are denoised in
+// parallel on OpenCV's worker threads. Every output pixel sees exactly the neighbourhood a
+// single full-image call would give it (tiles on the image border extrapolate the same way), so
+// the result is identical to cv::fastNlMeansDenoisingColored on the whole image, seams included.
+// `onProgress` receives the fraction of tiles done, from worker threads.
+cv::Mat denoiseTiled(const cv::Mat& image, const NlmParameters& params, int tileSize = 256, const std::function<void(double)>& onProgress = nullptr);
@@ -0,0 +1,78 @@
+﻿#include "Tiled_Execution.h"
+#include <algorithm>
+
+static TiledExecutionSettings settings_;
+
+void configureTiledExecution(const TiledExecutionSettings& settings) {
+    settings_ = settings;
+    settings_.stripBytes = std::max<std::size_t>(settings_.stripBytes, 1 << 20);
+}
+
+const TiledExecutionSettings& tiledExecutionSettings() {
+    return settings_;
+}
+
+bool useTiledExecution(cv::Size size) {
+    return (double)size.width * size.height >= settings_.minMegapixels * 1e6;
+}
+
+int stripRows(const cv::Mat& image, int halo) {
+    std::size_t rowBytes = std::max<std::size_t>(image.cols * image.elemSize(), 1);
+    int rows = (int)std::min<std::size_t>(settings_.stripBytes / rowBytes, (std::size_t)image.rows);
+    return std::max({rows, halo, 1});
+}
+
+void filterInStrips(cv::Mat& image, int halo, const StripFilter& filter, const std::function<void(double)>& onProgress) {
+    const int rows = stripRows(image, halo);
+    const int stripCount = (image.rows + rows - 1) / rows;
+    // Original values of the rows just above the current strip: the previous strip has already
+    // overwritten them in `image`, but they are this strip's upper halo.
+    cv::Mat rowsAbove;
+    for (int strip = 0; strip < stripCount; ++strip) {
+        const int first = strip * rows;
+        const int last = std::min(first + rows, image.rows);
+        const int top = first - rowsAbove.rows;
+        const int bottom = std::min(last + halo, image.rows);
+
+        cv::Mat input(bottom - top, image.cols, image.type());
+        if (!rowsAbove.empty()) {
+            rowsAbove.copyTo(input.rowRange(0, rowsAbove.rows));
+        }
+        image.rowRange(first, bottom).copyTo(input.rowRange(first - top, bottom - top));
+
+        // Saved before filtering, as the filter may work on `input` in place.
+        int keep = std::min(halo, last - top);
+        rowsAbove = keep > 0 ? input.rowRange(last - top - keep, last - top).clone() : cv::Mat();
+        cv::Mat output = filter(input);
+        CV_Assert(output.size() == input.size() && output.type() == image.type());
+        output.rowRange(first - top, last - top).copyTo(image.rowRange(first, last));
+
+        if (onProgress) {
+            onProgress((double)(strip + 1) / stripCount);
+        }
+    }
+}
+
+cv::Mat upscaleInStrips(const cv::Mat& image, int factor, int halo, const StripFilter& filter, const std::function<void(double)>& onProgress) {
+    const int rows = stripRows(image, halo);
+    const int stripCount = (image.rows + rows - 1) / rows;
+    cv::Mat upscaled;
+    for (int strip = 0; strip < stripCount; ++strip) {
+        const int first = strip * rows;
+        const int last = std::min(first + rows, image.rows);
+        const int top = std::max(first - halo, 0);
+        const int bottom = std::min(last + halo, image.rows);
+
+        cv::Mat output = filter(image.rowRange(top, bottom));
+        CV_Assert(output.cols == image.cols * factor && output.rows == (bottom - top) * factor);
+        if (upscaled.empty()) {
+            upscaled.create(image.rows * factor, image.cols * factor, output.type());
+        }
+        output.rowRange((first - top) * factor, (last - top) * factor).copyTo(upscaled.rowRange(first * factor, last * factor));
+
+        if (onProgress) {
+            onProgress((double)(strip + 1) / stripCount);
+        }
+    }
+    return upscaled;
+}
@@ -0,0 +1,38 @@
+﻿// Tiled_Execution.h : Runs whole-image stages strip by strip so their temporaries stay small.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <opencv2/core.hpp>
+
+// Deployment-wide settings, set once at startup before any job runs.
+struct TiledExecutionSettings {
+    double minMegapixels = 16.0;        // Images at least this large run their stages in strips
+    std::size_t stripBytes = 16 << 20;  // Input bytes per strip, halo rows excluded
+};
+
+void configureTiledExecution(const TiledExecutionSettings& settings);
+const TiledExecutionSettings& tiledExecutionSettings();
+
+// Whether the stages of an image this size run strip by strip.
+bool useTiledExecution(cv::Size size);
+
+// Rows per strip of this image: about stripBytes worth, and never fewer than `halo`.
+int stripRows(const cv::Mat& image, int halo);
+
+// Processes one strip. `input` holds the strip plus up to `halo` rows of context above and below
+// (fewer at the image border); the result covers the same rows, times the upscale factor.
+using StripFilter = std::function<cv::Mat(const cv::Mat& input)>;
+
+// Replaces `image` with filter(image), computed one full-width strip at a time and written back
+// in place. Every row is filtered with the same `halo` rows around it that a whole-image call
+// would see, so for filters that reach no further than the halo the result is identical (within
+// rounding for filters that accumulate in floating point, such as the guided filter), while
+// the extra memory is a few strips instead of one or more full-size temporaries.
+// `onProgress` receives the fraction of strips done.
+void filterInStrips(cv::Mat& image, int halo, const StripFilter& filter, const std::function<void(double)>& onProgress = nullptr);
+
+// Like filterInStrips for a filter that enlarges its input by an integer `factor` both ways. The
+// strips are read in place and their upscaled cores assembled into the returned image.
+cv::Mat upscaleInStrips(const cv::Mat& image, int factor, int halo, const StripFilter& filter, const std::function<void(double)>& onProgress = nullptr);
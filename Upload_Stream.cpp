@@ -0,0 +1,285 @@
+﻿#include "Upload_Stream.h"
+#include "Job_Store.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+namespace {
+
+// Longest header block of one part; real clients send two short lines.
+constexpr std::size_t MaxPartHeaderBytes = 16 << 10;
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) {
+        text.remove_suffix(1);
+    }
+    if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+        text = text.substr(1, text.size() - 2);
+    }
+    return text;
+}
+
+bool startsWithNoCase(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), text.begin(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+// The value of `key` in a header like `form-data; name="file"; filename="a.jpg"`.
+std::string_view headerParameter(std::string_view header, std::string_view key) {
+    std::size_t position = 0;
+    while (position <= header.size()) {
+        std::size_t semicolon = header.find(';', position);
+        std::string_view parameter = trim(header.substr(position, semicolon == std::string_view::npos ? std::string_view::npos : semicolon - position));
+        std::size_t equals = parameter.find('=');
+        if (equals != std::string_view::npos && trim(parameter.substr(0, equals)) == key) {
+            return trim(parameter.substr(equals + 1));
+        }
+        if (semicolon == std::string_view::npos) {
+            break;
+        }
+        position = semicolon + 1;
+    }
+    return std::string_view();
+}
+
+} // namespace
+
+std::shared_ptr<MultipartUploadStream> MultipartUploadStream::forRequest(const crow::request& req, const UploadStreamLimits& limits) {
+    const std::string& contentType = req.get_header_value("Content-Type");
+    if (!startsWithNoCase(contentType, "multipart/form-data")) {
+        return nullptr;
+    }
+    std::string_view boundary = headerParameter(contentType, "boundary");
+    if (boundary.empty() || boundary.size() > 200) {
+        return nullptr;
+    }
+    std::uint64_t contentLength = std::strtoull(req.get_header_value("Content-Length").c_str(), nullptr, 10);
+    return std::make_shared<MultipartUploadStream>(std::string(boundary), contentLength, limits);
+}
+
+MultipartUploadStream::MultipartUploadStream(std::string boundary, std::uint64_t contentLength, UploadStreamLimits limits)
+    : delimiter_("\r\n--" + boundary), contentLength_(contentLength), limits_(std::move(limits)) {
+    // The first boundary starts the body without a line break in front; seeding one lets every
+    // boundary be found with the same delimiter.
+    pending_ = "\r\n";
+}
+
+MultipartUploadStream::~MultipartUploadStream() {
+    for (UploadedFile& file : files_) {
+        if (file.spill.is_open()) {
+            file.spill.close();
+        }
+        if (!file.spillPath.empty()) {
+            std::error_code ignored;
+            std::filesystem::remove(file.spillPath, ignored);
+        }
+    }
+}
+
+bool MultipartUploadStream::write(const char* data, std::size_t size) {
+    pending_.append(data, size);
+    std::string_view input(pending_);
+    std::size_t consumed = 0;
+    bool needMore = false;
+    while (!needMore) {
+        std::string_view rest = input.substr(consumed);
+        switch (state_) {
+        case State::Preamble:
+        case State::Body: {
+            std::size_t found = rest.find(delimiter_);
+            if (found == std::string_view::npos) {
+                // Everything except a possible partial delimiter at the end belongs to the part.
+                std::size_t safe = rest.size() >= delimiter_.size() ? rest.size() - (delimiter_.size() - 1) : 0;
+                if (state_ == State::Body && !writePart(rest.data(), safe)) {
+                    return false;
+                }
+                consumed += safe;
+                needMore = true;
+                break;
+            }
+            if (state_ == State::Body && !writePart(rest.data(), found)) {
+                return false;
+            }
+            consumed += found + delimiter_.size();
+            state_ = State::AfterDelimiter;
+            break;
+        }
+        case State::AfterDelimiter:
+            if (rest.size() < 2) {
+                needMore = true;
+            }
+            else if (rest.substr(0, 2) == "--") {
+                consumed += 2;
+                state_ = State::Epilogue;
+            }
+            else if (rest.substr(0, 2) == "\r\n") {
+                consumed += 2;
+                state_ = State::Headers;
+            }
+            else {
+                return fail(400, "malformed multipart boundary");
+            }
+            break;
+        case State::Headers: {
+            std::size_t end = rest.find("\r\n\r\n");
+            if (end == std::string_view::npos) {
+                if (rest.size() > MaxPartHeaderBytes) {
+                    return fail(400, "multipart part headers too long");
+                }
+                needMore = true;
+                break;
+            }
+            if (!startPart(rest.substr(0, end))) {
+                return false;
+            }
+            consumed += end + 4;
+            state_ = State::Body;
+            break;
+        }
+        case State::Epilogue:
+            consumed = input.size();
+            needMore = true;
+            break;
+        }
+    }
+    pending_.erase(0, consumed);
+    return true;
+}
+
+bool MultipartUploadStream::finish() {
+    if (state_ != State::Epilogue) {
+        return fail(400, "multipart body ended before its closing boundary");
+    }
+    pending_.clear();
+    pending_.shrink_to_fit();
+    for (UploadedFile& file : files_) {
+        if (file.spill.is_open()) {
+            file.spill.close();
+            if (!file.spill) {
+                return fail(500, "could not write the upload spill file");
+            }
+        }
+    }
+    return true;
+}
+
+std::string_view MultipartUploadStream::field(const std::string& name) const {
+    auto found = fields_.find(name);
+    return found != fields_.end() ? std::string_view(found->second) : std::string_view();
+}
+
+bool MultipartUploadStream::fail(int status, const char* reason) {
+    errorStatus_ = status;
+    std::cerr << "[Upload] Rejected upload: " << reason << std::endl;
+    return false;
+}
+
+bool MultipartUploadStream::startPart(std::string_view headers) {
+    std::string_view disposition;
+    while (!headers.empty()) {
+        std::size_t lineEnd = headers.find("\r\n");
+        std::string_view line = headers.substr(0, lineEnd);
+        if (startsWithNoCase(line, "content-disposition:")) {
+            disposition = line.substr(std::string_view("content-disposition:").size());
+        }
+        headers = lineEnd == std::string_view::npos ? std::string_view() : headers.substr(lineEnd + 2);
+    }
+    partName_ = std::string(headerParameter(disposition, "name"));
+    if (partName_.empty()) {
+        return fail(400, "multipart part without a name");
+    }
+
+    inFilePart_ = partName_ == "file" || partName_ == "files";
+    if (!inFilePart_) {
+        fields_[partName_].clear();
+        return true;
+    }
+    if (files_.size() >= limits_.maxFiles) {
+        if (limits_.maxFiles == 1) {
+            return fail(400, "more than one 'file' part");
+        }
+        return fail(413, "too many file parts");
+    }
+    if (!files_.empty() && files_.back().spill.is_open()) {
+        // Close the previous file's spill so a long batch does not hold a descriptor per file.
+        files_.back().spill.close();
+        if (!files_.back().spill) {
+            return fail(500, "could not write the upload spill file");
+        }
+    }
+    UploadedFile& file = files_.emplace_back();
+    file.filename = std::string(headerParameter(disposition, "filename"));
+    if (limits_.maxFiles == 1) {
+        // The declared body length bounds the file size: allocate once, or skip memory altogether
+        // when the file cannot fit.
+        if (contentLength_ > limits_.memoryBytes) {
+            return openSpillFile(file);
+        }
+        file.buffer.reserve(static_cast<std::size_t>(contentLength_));
+        return true;
+    }
+    // Later files of a batch go straight to disk once earlier ones used up the memory budget.
+    if (memoryUsed_ >= limits_.memoryBytes) {
+        return openSpillFile(file);
+    }
+    return true;
+}
+
+bool MultipartUploadStream::writePart(const char* data, std::size_t size) {
+    if (size == 0) {
+        return true;
+    }
+    if (inFilePart_) {
+        return writeFile(data, size);
+    }
+    std::string& value = fields_[partName_];
+    if (value.size() + size > limits_.maxFieldBytes) {
+        return fail(413, "multipart field too large");
+    }
+    value.append(data, size);
+    return true;
+}
+
+bool MultipartUploadStream::writeFile(const char* data, std::size_t size) {
+    UploadedFile& file = files_.back();
+    file.hash.update(data, size);
+    file.size += size;
+    if (!file.spill.is_open() && memoryUsed_ + size > limits_.memoryBytes) {
+        // No Content-Length, it was wrong, or earlier files used the budget: move what was
+        // buffered of this file so far to disk.
+        if (!openSpillFile(file)) {
+            return false;
+        }
+        file.spill.write(file.buffer.data(), static_cast<std::streamsize>(file.buffer.size()));
+        memoryUsed_ -= file.buffer.size();
+        std::string().swap(file.buffer);
+    }
+    if (file.spill.is_open()) {
+        if (!file.spill.write(data, static_cast<std::streamsize>(size))) {
+            return fail(500, "could not write the upload spill file");
+        }
+        return true;
+    }
+    file.buffer.append(data, size);
+    memoryUsed_ += size;
+    return true;
+}
+
+bool MultipartUploadStream::openSpillFile(UploadedFile& file) {
+    std::error_code error;
+    std::filesystem::create_directories(limits_.spillDirectory, error);
+    file.spillPath = limits_.spillDirectory / ("upload-" + JobStore::createJobId() + ".part");
+    file.spill.open(file.spillPath, std::ios::binary | std::ios::trunc);
+    if (!file.spill) {
+        file.spillPath.clear();
+        return fail(500, "could not create the upload spill file");
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+﻿// Upload_Stream.h : Incremental multipart/form-data parser that receives uploads as they stream in.
+
+#pragma once
+
+#include "Crow/crow.h"
+#include "Result_Cache.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct UploadStreamLimits {
+    std::size_t memoryBytes = 8 << 20;        // File bytes kept in memory before spilling to disk
+    std::size_t maxFieldBytes = 64 << 10;     // Largest non-file field, e.g. "options"
+    std::size_t maxFiles = 1;                 // "file"/"files" parts accepted; POST /api/batch allows more
+    std::filesystem::path spillDirectory = "uploads/tmp";
+};
+
+// One "file" (or "files") part of an upload.
+struct UploadedFile {
+    std::string filename;       // As sent in Content-Disposition; may be empty
+    std::size_t size = 0;
+    XxHash64 hash;
+    std::string buffer;         // The bytes, unless spilled
+    std::filesystem::path spillPath;
+    std::ofstream spill;
+};
+
+// Receives a multipart/form-data body chunk by chunk from Crow (see crow::body_stream) and splits
+// it into parts without ever holding the whole body. File parts are hashed as they arrive and kept
+// in memory while all of them together fit in memoryBytes; the rest are written to spill files, so
+// a connection never holds more than about memoryBytes of upload. Other parts are small fields
+// kept as strings.
+class MultipartUploadStream : public crow::body_stream {
+public:
+    // Stream for a multipart request, or nullptr if the Content-Type has no boundary.
+    static std::shared_ptr<MultipartUploadStream> forRequest(const crow::request& req, const UploadStreamLimits& limits);
+
+    MultipartUploadStream(std::string boundary, std::uint64_t contentLength, UploadStreamLimits limits);
+    ~MultipartUploadStream() override;
+
+    bool write(const char* data, std::size_t size) override;
+    bool finish() override;
+    int error_status() const override { return errorStatus_; }
+
+    // File parts in the order they were sent; `index` below is a position in that order.
+    std::size_t fileCount() const { return files_.size(); }
+    bool hasFile() const { return !files_.empty(); }
+    const std::string& fileName(std::size_t index = 0) const { return files_[index].filename; }
+    std::size_t fileSize(std::size_t index = 0) const { return files_[index].size; }
+    // XXH64 (seed 0) of the file bytes, for ResultCache::makeKey.
+    std::uint64_t fileHash(std::size_t index = 0) const { return files_[index].hash.digest(); }
+    // Whether the file went to spillPath() instead of fileBytes().
+    bool spilled(std::size_t index = 0) const { return !files_[index].spillPath.empty(); }
+    std::string_view fileBytes(std::size_t index = 0) const { return files_[index].buffer; }
+    const std::filesystem::path& spillPath(std::size_t index = 0) const { return files_[index].spillPath; }
+    // Body of a non-file field; empty if it was not sent.
+    std::string_view field(const std::string& name) const;
+
+private:
+    enum class State { Preamble, AfterDelimiter, Headers, Body, Epilogue };
+
+    bool fail(int status, const char* reason);
+    bool startPart(std::string_view headers);
+    bool writePart(const char* data, std::size_t size);
+    bool writeFile(const char* data, std::size_t size);
+    bool openSpillFile(UploadedFile& file);
+
+    const std::string delimiter_; // "\r\n--" + boundary
+    const std::uint64_t contentLength_;
+    const UploadStreamLimits limits_;
+
+    State state_ = State::Preamble;
+    std::string pending_;         // Bytes not yet assigned to a part: a partial delimiter or header block
+    std::string partName_;
+    bool inFilePart_ = false;
+    std::map<std::string, std::string, std::less<>> fields_;
+
+    std::vector<UploadedFile> files_;
+    std::size_t memoryUsed_ = 0;  // Bytes of all file buffers
+
+    int errorStatus_ = 400;
+};
@@ -11,6 +11,9 @@ const ENHANCE_OPTIONS = [
   { key: "beautify", icon: <FaSmile />, label: "Beautify" }
 ];
 
+const API_BASE = "http://127.0.0.1:8080";
+const WS_BASE = "ws://127.0.0.1:8080";
+
 const OUTPUT_FORMATS = [
   { value: "png", label: "PNG (Best Quality)" },
   { value: "jpeg", label: "JPEG" }
@@ -77,6 +80,8 @@ export default function UploadPage() {
   const [slider, setSlider] = useState(50); // Start at 50 (middle)
   const [isDragging, setIsDragging] = useState(false);
   const [isLoading, setIsLoading] = useState(false);
+  const [progress, setProgress] = useState(null); // { percent, stage } pushed over the job WebSocket
+  const [preview, setPreview] = useState(null);
   const [error, setError] = useState("");
   const [fileObj, setFileObj] = useState(null);
   const [outputFormat, setOutputFormat] = useState("png");
@@ -102,10 +107,42 @@ export default function UploadPage() {
     setJpegQuality(95);
   };
 
+  // Follow a queued job over its WebSocket until it is done or failed.
+  const watchJob = (jobId) => new Promise((resolve, reject) => {
+    const ws = new WebSocket(`${WS_BASE}/ws/jobs/${jobId}?preview=1`);
+    ws.binaryType = "blob";
+    let finished = false;
+    ws.onmessage = (event) => {
+      if (typeof event.data !== "string") {
+        setPreview((old) => {
+          if (old) URL.revokeObjectURL(old);
+          return URL.createObjectURL(event.data);
+        });
+        return;
+      }
+      const status = JSON.parse(event.data);
+      const running = status.stages.find((s) => s.state === "running");
+      setProgress({ percent: Math.round(status.progress * 100), stage: running ? running.name : null });
+      if (status.state === "done") {
+        finished = true;
+        resolve(status.resultUrl);
+      } else if (status.state === "failed") {
+        finished = true;
+        reject(new Error(status.error));
+      }
+    };
+    ws.onerror = () => reject(new Error("Progress connection failed"));
+    ws.onclose = () => {
+      if (!finished) reject(new Error("Progress connection closed"));
+    };
+  });
+
   // Actually call enhancement (when options are picked)
   const enhanceNow = async (opts = options, file = fileObj) => {
     if (!file) return;
     setIsLoading(true);
+    setProgress(null);
+    setPreview(null);
     const formData = new FormData();
     formData.append("file", file);
     formData.append("options", JSON.stringify({
@@ -114,17 +151,23 @@ export default function UploadPage() {
       jpegQuality: outputFormat === "jpeg" ? jpegQuality : undefined
     }));
     try {
-      const res = await fetch("http://127.0.0.1:8080/api/upload", {
+      const res = await fetch(`${API_BASE}/api/jobs`, {
         method: "POST",
         body: formData,
       });
       if (!res.ok) throw new Error("Failed to process image");
       const data = await res.json();
-      setEnhanced(`http://127.0.0.1:8080${data.processedImageUrl}`);
+      const resultUrl = await watchJob(data.jobId);
+      setEnhanced(`${API_BASE}${resultUrl}`);
     } catch (e) {
       setError("Enhancement failed. Try again.");
     } finally {
       setIsLoading(false);
+      setProgress(null);
+      setPreview((old) => {
+        if (old) URL.revokeObjectURL(old);
+        return null;
+      });
     }
   };
 
@@ -278,8 +321,10 @@ export default function UploadPage() {
 
         {isLoading && (
           <div className="processing-overlay">
-            <div className="loading-spinner" />
-            <p className="processing-text noselect">Enhancing...</p>
+            {preview ? <img className="processing-preview" src={preview} alt="Preview" /> : <div className="loading-spinner" />}
+            <p className="processing-text noselect">
+              {progress ? `Enhancing... ${progress.percent}%${progress.stage ? ` (${progress.stage})` : ""}` : "Enhancing..."}
+            </p>
           </div>
         )}
 